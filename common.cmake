@@ -0,0 +1,4 @@
+set(CMAKE_CXX_FLAGS "-std=c++17 -Wall -Werror -Wextra -pedantic")
+set(CMAKE_BUILD_TYPE Release)
+
+
@@ -1,68 +1,172 @@
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <fcntl.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
-#include <sys/types.h>
+#include <memory>
 
 #include "compact-radix-trie.hh"
-#include "radix-trie.hh"
+#include "dictionary-overlay.hh"
+#include "dictionary-watcher.hh"
+#include "dictionary.hh"
+#include "edit-costs.hh"
+#include "line-io.hh"
+#include "query-loop.hh"
+#include "query.hh"
+#include "result-cache.hh"
+#include "server.hh"
+#include "thread-pool.hh"
+#include "work-stealing-pool.hh"
 
-void print_matches(std::ostream& out, const RadixTrie::matches_t& matches)
+void usage(const char* name)
 {
-    out << "[";
-    for (unsigned i = 0; i < matches.size(); i++)
-    {
-        const auto& r = matches[i];
-        out << "{" <<
-            "\"word\":\"" << r.word << "\","
-            "\"freq\":" << r.freq << ","
-            "\"distance\":" << r.distance << "}";
-        if (i != matches.size() - 1)
-            out << ",";
-    }
-    out << "]" << std::endl;
+    std::cout << "Usage: " << name <<
+        " [--threads N] [--listen /path/to/socket] [--watch]"
+        " [--log /path/to/delta.log] [--batch] [--cache MB]"
+        " [--costs /path/to/costs.txt] [--utf8] [--split NODES]"
+        " /path/to/compiled/dict.bin" << std::endl;
+    std::abort();
+}
+
+void print_cache_stats(const ResultCache& cache)
+{
+    auto s = cache.stats();
+    uint64_t total = std::max<uint64_t>(s.hits + s.misses, 1);
+    std::cerr << "Cache: " << s.hits << " hits, " << s.misses <<
+        " misses (" << 100 * s.hits / total << "% hits), " << s.entries <<
+        " answers in " << s.bytes / 1024 << " KB" << std::endl;
 }
 
 int main(int argc, char* argv[])
 {
-    if (argc < 2)
+    const char* dict_path = nullptr;
+    const char* socket_path = nullptr;
+    const char* log_path = nullptr;
+    const char* costs_path = nullptr;
+    bool watch = false;
+    bool batch_search = false;
+    bool utf8 = false;
+    size_t cache_size = 0; // in MB, no cache by default
+    uint64_t split_budget = 0; // queries are not split by default
+    unsigned nb_threads = 0; // not given
+
+    for (int i = 1; i < argc; i++)
     {
-        std::cout << "Usage: " << argv[0] << " /path/to/compiled/dict.bin";
-        std::cout << std::endl;
-        std::abort();
+        if (!strcmp(argv[i], "--threads"))
+        {
+            if (++i == argc)
+                usage(argv[0]);
+            // 0 means one thread per core
+            nb_threads = std::strtoul(argv[i], nullptr, 10);
+            if (!nb_threads)
+                nb_threads = ThreadPool::default_size();
+        }
+        else if (!strcmp(argv[i], "--batch"))
+            batch_search = true;
+        else if (!strcmp(argv[i], "--utf8"))
+            utf8 = true;
+        else if (!strcmp(argv[i], "--cache"))
+        {
+            if (++i == argc)
+                usage(argv[0]);
+            cache_size = std::strtoul(argv[i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "--split"))
+        {
+            if (++i == argc)
+                usage(argv[0]);
+            split_budget = std::strtoull(argv[i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "--costs"))
+        {
+            if (++i == argc)
+                usage(argv[0]);
+            costs_path = argv[i];
+        }
+        else if (!strcmp(argv[i], "--watch"))
+            watch = true;
+        else if (!strcmp(argv[i], "--listen"))
+        {
+            if (++i == argc)
+                usage(argv[0]);
+            socket_path = argv[i];
+        }
+        else if (!strcmp(argv[i], "--log"))
+        {
+            if (++i == argc)
+                usage(argv[0]);
+            log_path = argv[i];
+        }
+        else
+            dict_path = argv[i];
     }
+    if (!dict_path)
+        usage(argv[0]);
 
-    int fd = -1;
-    if ((fd = open(argv[1], 0)) == -1)
-        abort();
+    std::string error;
+    auto dict = Dictionary::open(dict_path, error);
+    if (!dict)
+    {
+        std::cerr << error << std::endl;
+        return 1;
+    }
 
-    struct stat s;
-    if (fstat(fd, &s) < 0)
-        abort();
+    // With --log, the words added and deleted are kept across restarts
+    OverlayWriter overlay;
+    if (log_path && !overlay.open_log(log_path, error))
+    {
+        std::cerr << error << std::endl;
+        return 1;
+    }
 
-    void* file = mmap(NULL, s.st_size, PROT_READ, MAP_FILE | MAP_SHARED, fd, 0);
-    char* start = reinterpret_cast<char*>(file);
+    // With --watch, the dictionary is replaced when its file is
+    if (socket_path)
+        QueryServer::block_signals();
+    DictionaryWatcher dicts(dict_path, std::move(dict), watch);
 
-    while (!std::cin.eof())
+    // With --costs, the distances are weighted by the costs of the file
+    std::unique_ptr<EditCostTable> costs;
+    if (costs_path && !(costs = EditCostTable::open(costs_path, error)))
     {
-        std::string approx;
-        std::string word;
-        int max_dist = -1;
+        std::cerr << error << std::endl;
+        return 1;
+    }
 
-        std::cin >> approx;
-        std::cin >> max_dist;
-        std::cin >> word;
+    // With --cache, the answers are kept until the dictionary changes
+    std::unique_ptr<ResultCache> cache;
+    if (cache_size)
+        cache = std::make_unique<ResultCache>(cache_size << 20);
+    answer_options_t options;
+    options.cache = cache.get();
+    options.costs = costs.get();
+    options.utf8 = utf8;
 
-        if (!word.size())
-            continue;
+    // With --split, a query visiting that many nodes is walked by every core
+    std::unique_ptr<WorkStealingPool> splitter;
+    if (split_budget)
+    {
+        splitter = std::make_unique<WorkStealingPool>(
+                ThreadPool::default_size() - 1);
+        options.pool = splitter.get();
+        options.split_budget = split_budget;
+    }
 
-        if (max_dist >= 0)
-        {
-            auto res = CompactRadixTrie::matches(word, start, max_dist);
-            print_matches(std::cout, res);
-        }
-        else
-            print_matches(std::cout, {});
+    // The server uses every core by default
+    if (socket_path)
+    {
+        QueryServer server(dicts, overlay, options, nb_threads);
+        int res = server.run(socket_path);
+        if (cache)
+            print_cache_stats(*cache);
+        return res;
     }
+
+    LineReader in(STDIN_FILENO);
+    OutputBuffer out(STDOUT_FILENO);
+    if (nb_threads > 1)
+        run_parallel(in, out, dicts, overlay, options, nb_threads,
+                     batch_search);
+    else
+        run_sequential(in, out, dicts, overlay, options, batch_search);
+    if (cache)
+        print_cache_stats(*cache);
     return 0;
 }
@@ -0,0 +1,359 @@
+// Measures the queries of TextMiningApp on a compiled dictionary, by maximum
+// distance: throughput, latency percentiles, visited nodes, computed distance
+// cells and peak memory. The queries are read from a file or generated by
+// misspelling words of the dictionary. With --reference, the answers are
+// compared to the ones of another TextMiningApp (e.g. subject/ref) on its own
+// dictionary, and the exit status is 1 if any differ. With --split, the
+// queries are split as by TextMiningApp --split, over THREADS workers.
+//
+//   ./TextMiningBench --generate 1000 dict.bin
+//   ./TextMiningBench --max-distance 4 --split 20000 --threads 4 dict.bin
+//   ./TextMiningBench --queries queries.txt
+//       --reference subject/ref/TextMiningApp ref.bin dict.bin
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <set>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "compact-radix-trie.hh"
+#include "json-output.hh"
+#include "query-arena.hh"
+#include "thread-pool.hh"
+#include "work-stealing-pool.hh"
+
+struct query_t
+{
+    unsigned max_dist;
+    std::string word;
+    int top; // -1 for an approx query
+};
+
+struct result_t
+{
+    std::vector<double> latencies; // us
+    double total; // us
+    uint64_t nodes;
+    uint64_t cells;
+    long peak_rss; // KB, once the queries are answered
+    size_t mismatches;
+};
+
+void usage(const char* name)
+{
+    std::cout << "Usage: " << name << " [--queries FILE | --generate N"
+        " [--seed S] [--max-distance D]] [--reference APP DICT]"
+        " [--split NODES [--threads THREADS]]"
+        " /path/to/compiled/dict.bin" << std::endl;
+    std::abort();
+}
+
+bool read_queries(const char* path, std::vector<query_t>& queries)
+{
+    std::ifstream in(path);
+    if (!in.is_open())
+        return false;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        std::istringstream words(line);
+        std::string approx;
+        query_t q{0, "", -1};
+        words >> approx;
+        if (approx == "approx-top")
+            words >> q.top;
+        if (words >> q.max_dist >> q.word)
+            queries.push_back(q);
+    }
+    return true;
+}
+
+// Picks n words of the dictionary (reservoir sampling), and misspells each of
+// them with d random edits for each distance d up to max_dist
+void generate_queries(const char* start, size_t n, unsigned seed,
+                      unsigned max_dist, std::vector<query_t>& queries)
+{
+    std::mt19937 rng(seed);
+    std::vector<std::string> sample;
+    std::set<char> alphabet;
+    size_t seen = 0;
+    CompactRadixTrie::for_each_word(start,
+            [&](const std::string& word, unsigned) {
+                alphabet.insert(word.begin(), word.end());
+                if (sample.size() < n)
+                    sample.push_back(word);
+                else
+                {
+                    size_t i = std::uniform_int_distribution<size_t>(
+                            0, seen)(rng);
+                    if (i < n)
+                        sample[i] = word;
+                }
+                seen++;
+            });
+    if (sample.empty())
+        return;
+    std::vector<char> letters(alphabet.begin(), alphabet.end());
+
+    for (unsigned d = 0; d <= max_dist; d++)
+        for (size_t i = 0; i < n; i++)
+        {
+            std::string word = sample[rng() % sample.size()];
+            for (unsigned e = 0; e < d; e++)
+            {
+                size_t pos = rng() % word.size();
+                char c = letters[rng() % letters.size()];
+                switch (rng() % 4)
+                {
+                case 0: // substitution
+                    word[pos] = c;
+                    break;
+                case 1: // insertion
+                    word.insert(word.begin() + pos, c);
+                    break;
+                case 2: // deletion
+                    if (word.size() > 1)
+                        word.erase(pos, 1);
+                    break;
+                case 3: // transposition
+                    if (pos + 1 < word.size())
+                        std::swap(word[pos], word[pos + 1]);
+                    break;
+                }
+            }
+            queries.push_back(query_t{d, word, -1});
+        }
+}
+
+// Runs app on dict with the queries, returns the lines of its output
+bool run_reference(const char* app, const char* dict,
+                   const std::vector<query_t>& queries,
+                   std::vector<std::string>& lines)
+{
+    FILE* in = tmpfile();
+    if (!in)
+        return false;
+    for (const auto& q : queries)
+    {
+        if (q.top >= 0)
+            fprintf(in, "approx-top %d %u %s\n", q.top, q.max_dist,
+                    q.word.c_str());
+        else
+            fprintf(in, "approx %u %s\n", q.max_dist, q.word.c_str());
+    }
+    fflush(in);
+    rewind(in);
+
+    int out[2];
+    if (pipe(out) < 0)
+        return false;
+    pid_t pid = fork();
+    if (pid < 0)
+        return false;
+    if (pid == 0)
+    {
+        dup2(fileno(in), 0);
+        dup2(out[1], 1);
+        close(out[0]);
+        execl(app, app, dict, static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    close(out[1]);
+    fclose(in);
+
+    std::string output;
+    char buf[1 << 16];
+    ssize_t len;
+    while ((len = read(out[0], buf, sizeof (buf))) > 0)
+        output.append(buf, len);
+    close(out[0]);
+
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+        return false;
+
+    std::istringstream lines_in(output);
+    std::string line;
+    while (std::getline(lines_in, line))
+        lines.push_back(line + "\n");
+    return true;
+}
+
+long peak_rss()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+double percentile(const std::vector<double>& sorted, double p)
+{
+    return sorted[std::min(sorted.size() - 1, size_t(sorted.size() * p))];
+}
+
+int main(int argc, char* argv[])
+{
+    const char* dict_path = nullptr;
+    const char* queries_path = nullptr;
+    const char* ref_app = nullptr;
+    const char* ref_dict = nullptr;
+    size_t generate = 1000;
+    unsigned seed = 42;
+    unsigned max_dist = 2;
+    uint64_t split_budget = 0;
+    unsigned nb_threads = ThreadPool::default_size();
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--queries") && has_value)
+            queries_path = argv[++i];
+        else if (!strcmp(argv[i], "--generate") && has_value)
+            generate = std::strtoul(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "--seed") && has_value)
+            seed = std::strtoul(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "--max-distance") && has_value)
+            max_dist = std::strtoul(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "--split") && has_value)
+            split_budget = std::strtoull(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "--threads") && has_value)
+            nb_threads = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+        else if (!strcmp(argv[i], "--reference") && i + 2 < argc)
+        {
+            ref_app = argv[++i];
+            ref_dict = argv[++i];
+        }
+        else if (!strncmp(argv[i], "--", 2))
+            usage(argv[0]);
+        else
+            dict_path = argv[i];
+    }
+    if (!dict_path)
+        usage(argv[0]);
+
+    int fd = -1;
+    if ((fd = open(dict_path, 0)) == -1)
+        abort();
+
+    struct stat s;
+    if (fstat(fd, &s) < 0)
+        abort();
+
+    void* file = mmap(NULL, s.st_size, PROT_READ, MAP_FILE | MAP_SHARED, fd, 0);
+    if (file == MAP_FAILED)
+        abort();
+    const char* start = reinterpret_cast<const char*>(file);
+
+    if (!CompactRadixTrie::version(start, s.st_size))
+    {
+        std::cerr << "Invalid or unsupported dictionary: " << dict_path <<
+            std::endl;
+        return 1;
+    }
+
+    std::vector<query_t> queries;
+    if (queries_path)
+    {
+        if (!read_queries(queries_path, queries))
+        {
+            std::cerr << "File not found: " << queries_path << std::endl;
+            return 1;
+        }
+    }
+    else
+        generate_queries(start, generate, seed, max_dist, queries);
+    if (queries.empty())
+    {
+        std::cerr << "No queries" << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> expected;
+    if (ref_app && !run_reference(ref_app, ref_dict, queries, expected))
+    {
+        std::cerr << "Could not run " << ref_app << std::endl;
+        return 1;
+    }
+    if (ref_app && expected.size() != queries.size())
+        std::cerr << ref_app << " answered " << expected.size() <<
+            " queries out of " << queries.size() << std::endl;
+
+    // The thread answering the queries is one of the threads of a split
+    WorkStealingPool pool(split_budget ? nb_threads - 1 : 0);
+    std::map<unsigned, result_t> results;
+    QueryArena arena;
+    std::string out;
+    for (size_t i = 0; i < queries.size(); i++)
+    {
+        const query_t& q = queries[i];
+        result_t& r = results[q.max_dist];
+        arena.stats() = QueryArena::stats_t{0, 0};
+
+        out.clear();
+        auto t0 = std::chrono::steady_clock::now();
+        if (q.top >= 0)
+            CompactRadixTrie::top_matches(arena, q.word, start, q.top,
+                                          q.max_dist);
+        else if (split_budget)
+            CompactRadixTrie::parallel_matches(arena, q.word, start,
+                    q.max_dist, CompactRadixTrie::no_overlay_t(), pool,
+                    split_budget);
+        else
+            CompactRadixTrie::matches(arena, q.word, start, q.max_dist);
+        print_matches(out, arena);
+        auto t1 = std::chrono::steady_clock::now();
+
+        double us = std::chrono::duration<double, std::micro>(t1 - t0).count();
+        r.latencies.push_back(us);
+        r.total += us;
+        r.nodes += arena.stats().nodes;
+        r.cells += arena.stats().cells;
+        r.peak_rss = peak_rss();
+        if (ref_app && (i >= expected.size() || expected[i] != out))
+        {
+            if (!r.mismatches)
+                std::cerr << "First mismatch at distance " << q.max_dist <<
+                    ": " << q.word << std::endl;
+            r.mismatches++;
+        }
+    }
+
+    printf("%8s %8s %10s %10s %10s %10s %10s %12s %10s %10s\n", "distance",
+           "queries", "qps", "p50(us)", "p99(us)", "p99.9(us)", "nodes/q",
+           "cells/q", "rss(MB)", "mismatch");
+    size_t mismatches = 0;
+    for (auto& p : results)
+    {
+        result_t& r = p.second;
+        double n = r.latencies.size();
+        std::sort(r.latencies.begin(), r.latencies.end());
+        printf("%8u %8zu %10.0f %10.1f %10.1f %10.1f %10.0f %12.0f %10.1f ",
+               p.first, r.latencies.size(), n / r.total * 1e6,
+               percentile(r.latencies, 0.5), percentile(r.latencies, 0.99),
+               percentile(r.latencies, 0.999), r.nodes / n, r.cells / n,
+               r.peak_rss / 1024.);
+        if (ref_app)
+            printf("%10zu\n", r.mismatches);
+        else
+            printf("%10s\n", "-");
+        mismatches += r.mismatches;
+    }
+
+    munmap(file, s.st_size);
+    close(fd);
+    return mismatches ? 1 : 0;
+}
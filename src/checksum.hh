@@ -0,0 +1,95 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <streambuf>
+
+// CRC-32 (IEEE 802.3) of the compiled dictionaries, computed incrementally
+class Checksum
+{
+public:
+    Checksum()
+      : crc_(~uint32_t(0))
+    {
+    }
+
+    void update(const char* data, size_t len)
+    {
+        const auto& table = table_();
+        uint32_t crc = crc_;
+        for (size_t i = 0; i < len; i++)
+            crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xff] ^
+                (crc >> 8);
+        crc_ = crc;
+    }
+
+    uint32_t value() const
+    {
+        return ~crc_;
+    }
+
+    static uint32_t of(const char* data, size_t len)
+    {
+        Checksum sum;
+        sum.update(data, len);
+        return sum.value();
+    }
+
+private:
+    static const std::array<uint32_t, 256>& table_()
+    {
+        static const std::array<uint32_t, 256> table = []() {
+            std::array<uint32_t, 256> t;
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                    c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+                t[i] = c;
+            }
+            return t;
+        }();
+        return table;
+    }
+
+    uint32_t crc_;
+};
+
+// Output buffer forwarding everything to another one, computing the checksum
+// of what goes through it. Nothing is buffered, so writing to the underlying
+// buffer directly in between keeps the order of the bytes.
+class ChecksumBuf : public std::streambuf
+{
+public:
+    ChecksumBuf(std::streambuf* out)
+      : out_(out)
+      , sum_()
+    {
+    }
+
+    uint32_t value() const
+    {
+        return sum_.value();
+    }
+
+protected:
+    std::streamsize xsputn(const char* s, std::streamsize n) override
+    {
+        std::streamsize res = out_->sputn(s, n);
+        sum_.update(s, res);
+        return res;
+    }
+
+    int_type overflow(int_type c) override
+    {
+        if (traits_type::eq_int_type(c, traits_type::eof()))
+            return traits_type::not_eof(c);
+        char ch = traits_type::to_char_type(c);
+        return xsputn(&ch, 1) == 1 ? c : traits_type::eof();
+    }
+
+private:
+    std::streambuf* out_;
+    Checksum sum_;
+};
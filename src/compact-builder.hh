@@ -0,0 +1,250 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "checksum.hh"
+#include "compact-format.hh"
+
+// Builds a compact trie from words given in increasing (byte) order, in a
+// single forward pass. A node is written as soon as the next word leaves its
+// subtree, after its children (post-order, with backward offsets), so only
+// the nodes on the path of the last word are kept in memory. The header is
+// patched once the root has been written.
+class CompactBuilder
+{
+public:
+    CompactBuilder(std::ostream& out)
+      : out_(out)
+      , start_(out.tellp())
+      , sum_(out.rdbuf())
+      , body_(&sum_)
+      , pos_(0)
+      , last_()
+      , path_()
+      , error_()
+    {
+        CompactFormat::Header header;
+        memset(&header, 0, sizeof (header));
+        out_.write(reinterpret_cast<const char*>(&header), sizeof (header));
+        pos_ += sizeof (header);
+        path_.push_back(open_node_t{0, 0, 0, {}});
+    }
+
+    // Returns false and sets error() if the word comes before the previous
+    // one, or if the file got too big for its offsets. A word given several
+    // times in a row keeps its last frequency.
+    bool add(const std::string& word, unsigned freq)
+    {
+        if (!error_.empty())
+            return false;
+        if (word < last_)
+        {
+            error_ = "Words are not sorted: " + word;
+            return false;
+        }
+        size_t lcp = std::distance(word.begin(),
+                std::mismatch(word.begin(), word.end(), last_.begin(),
+                              last_.end()).first);
+        close_(lcp);
+        if (word.size() == lcp) // same word
+        {
+            path_.back().freq = freq;
+            path_.back().max_freq = freq; // the word has no children yet
+        }
+        else
+            path_.push_back(open_node_t{word.size(), freq, freq, {}});
+        last_ = word;
+        return error_.empty();
+    }
+
+    // Writes the remaining nodes and the header. Returns false and sets
+    // error() if the file is invalid, see add().
+    bool finish()
+    {
+        if (!error_.empty())
+            return false;
+        close_(0);
+        open_node_t& root = path_.back();
+        sort_children_(root);
+        uint64_t root_pos = pos_;
+        write_head_(root, bounds_(root));
+        if (root_pos > std::numeric_limits<uint32_t>::max())
+            too_big_();
+        if (!error_.empty())
+            return false;
+
+        CompactFormat::Header header;
+        memset(&header, 0, sizeof (header));
+        memcpy(header.magic, CompactFormat::magic, sizeof (header.magic));
+        header.version = CompactFormat::version;
+        header.size = pos_;
+        header.root = root_pos;
+        header.checksum = sum_.value();
+
+        std::streamoff end = out_.tellp();
+        out_.seekp(start_);
+        out_.write(reinterpret_cast<const char*>(&header), sizeof (header));
+        out_.seekp(end);
+        return true;
+    }
+
+    const std::string& error() const
+    {
+        return error_;
+    }
+
+private:
+    // A written child, as seen from its parent
+    struct child_ref_t
+    {
+        uint64_t pos; // of its CompactChild
+        uint32_t max_freq;
+        char key; // first character of its label
+        CompactFormat::Bounds bounds;
+    };
+
+    // A node on the path of the last word
+    struct open_node_t
+    {
+        size_t depth; // length of its prefix
+        uint32_t freq;
+        uint32_t max_freq;
+        std::vector<child_ref_t> children;
+    };
+
+    // Everything after the header goes through the checksum
+    template <typename T>
+    void write_(const T& value)
+    {
+        body_.write(reinterpret_cast<const char*>(&value), sizeof (T));
+        pos_ += sizeof (T);
+    }
+
+    void pad_(size_t n)
+    {
+        pos_ += n;
+        for (; n; n--)
+            body_.put(0);
+    }
+
+    // Writes the nodes deeper than depth, which no next word can reach
+    void close_(size_t depth)
+    {
+        while (path_.back().depth > depth)
+        {
+            open_node_t node = std::move(path_.back());
+            path_.pop_back();
+            // The edge to the node is split by the new word
+            if (path_.back().depth < depth)
+                path_.push_back(open_node_t{depth, 0, 0, {}});
+
+            open_node_t& parent = path_.back();
+            child_ref_t ref = write_node_(node, last_.data() + parent.depth,
+                                          node.depth - parent.depth);
+            parent.children.push_back(ref);
+            parent.max_freq = std::max(parent.max_freq, ref.max_freq);
+        }
+    }
+
+    // Same order as RadixTrie::serialize_compact, which the top-k search
+    // prunes on
+    static void sort_children_(open_node_t& node)
+    {
+        std::sort(node.children.begin(), node.children.end(),
+                  [](const child_ref_t& a, const child_ref_t& b) {
+                      if (a.max_freq != b.max_freq)
+                          return a.max_freq > b.max_freq;
+                      return a.key < b.key;
+                  });
+    }
+
+    child_ref_t write_node_(open_node_t& node, const char* label, size_t len)
+    {
+        sort_children_(node);
+
+        // Long labels are split, the last part leading to the node itself
+        const size_t max_len = CompactFormat::max_label_len;
+        size_t begin = (len - 1) / max_len * max_len;
+        uint64_t pos = write_edge_(label + begin, len - begin);
+        CompactFormat::Bounds bounds = bounds_(node);
+        bounds.add_label(label + begin, len - begin);
+        write_head_(node, bounds);
+        while (begin)
+        {
+            child_ref_t next{pos, node.max_freq, label[begin], bounds};
+            begin -= max_len;
+            pos = write_edge_(label + begin, max_len);
+            open_node_t split{0, 0, node.max_freq, {next}};
+            bounds.add_label(label + begin, max_len);
+            write_head_(split, bounds);
+        }
+        return child_ref_t{pos, node.max_freq, label[0], bounds};
+    }
+
+    // Bounds of the words of the subtree of a node, without its label
+    static CompactFormat::Bounds bounds_(const open_node_t& node)
+    {
+        auto res = CompactFormat::Bounds::of_node(node.freq != 0);
+        for (const auto& c : node.children)
+            res.add_child(c.bounds);
+        return res;
+    }
+
+    // Writes a CompactChild, returns its position
+    uint64_t write_edge_(const char* label, size_t len)
+    {
+        uint64_t pos = pos_;
+        write_(uint8_t(len));
+        body_.write(label, len);
+        pos_ += len;
+        pad_(CompactFormat::padding(1 + len));
+        return pos;
+    }
+
+    void write_head_(const open_node_t& node,
+                     const CompactFormat::Bounds& bounds)
+    {
+        uint64_t head = pos_;
+        uint16_t nb_children = node.children.size();
+        write_(node.freq);
+        write_(node.max_freq);
+        write_(nb_children);
+        write_(bounds.min_len);
+        write_(bounds.max_len);
+        write_(bounds.chars);
+        for (const auto& c : node.children)
+        {
+            int64_t offset = int64_t(c.pos) - int64_t(head);
+            if (offset < std::numeric_limits<int32_t>::min() ||
+                offset > std::numeric_limits<int32_t>::max())
+                too_big_();
+            write_(int32_t(offset));
+        }
+        for (const auto& c : node.children)
+            body_.put(c.key);
+        pos_ += nb_children;
+        pad_(CompactFormat::padding(nb_children));
+    }
+
+    void too_big_()
+    {
+        if (error_.empty())
+            error_ = "Dictionary too big for the 32-bit offsets of the "
+                "compact format";
+    }
+
+    std::ostream& out_;
+    std::streamoff start_;
+    ChecksumBuf sum_;
+    std::ostream body_;
+    uint64_t pos_; // from the start of the file
+    std::string last_;
+    std::vector<open_node_t> path_; // from the root
+    std::string error_; // empty unless the file is invalid
+};
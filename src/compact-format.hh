@@ -0,0 +1,473 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <unistd.h>
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+// On-disk layouts of the compact radix trie. The radix trie formats describe
+// the trie as a CompactHead per node, listing the offsets of its CompactChild
+// records; each CompactChild holds the label of an edge and is directly
+// followed by the CompactHead of the node it leads to. The search code only
+// goes through the node_t and edge_t handles and the static accessors of a
+// format, so it works the same on all of them.
+
+// Order in which the compiler places the nodes of the trie in the file
+enum class CompactLayout
+{
+    dfs, // depth-first pre-order
+    bfs, // breadth-first, the top levels are contiguous
+    veb, // van Emde Boas: recursively split by height in top/bottom trees
+};
+
+// Legacy layout: no header, size_t fields and unaligned records. The root
+// CompactHead is at the start of the file.
+struct CompactFormatV1
+{
+    static constexpr bool bounded = false;
+
+    struct CompactHead
+    {
+        unsigned freq;
+        size_t nb_children;
+        size_t offset[1]; // offset from CompactHead address
+    } __attribute__((packed));
+
+    struct CompactChild
+    {
+        size_t label_len;
+        char label[1];
+    } __attribute__((packed));
+
+    using node_t = const CompactHead*;
+    using edge_t = const CompactChild*;
+
+    static const CompactHead* root(const char* start)
+    {
+        return reinterpret_cast<const CompactHead*>(start);
+    }
+
+    static unsigned freq(const CompactHead* h)
+    {
+        return h->freq;
+    }
+
+    static unsigned max_freq(const CompactHead*)
+    {
+        return std::numeric_limits<unsigned>::max(); // unknown
+    }
+
+    static size_t nb_children(const CompactHead* h)
+    {
+        return h->nb_children;
+    }
+
+    static const CompactChild* child(const CompactHead* h, size_t c)
+    {
+        return reinterpret_cast<const CompactChild*>(
+                reinterpret_cast<const char*>(h) + h->offset[c]);
+    }
+
+    static size_t label_len(const CompactChild* ch)
+    {
+        return ch->label_len;
+    }
+
+    static const char* label(const CompactChild* ch)
+    {
+        return ch->label;
+    }
+
+    // Its label and the start of its CompactHead
+    static void prefetch(const CompactChild* ch)
+    {
+        __builtin_prefetch(ch);
+    }
+
+    static const CompactHead* head(const CompactChild* ch)
+    {
+        return reinterpret_cast<const CompactHead*>(
+                ch->label + ch->label_len);
+    }
+
+    // Index of the child whose label starts with c, -1 if there is none
+    static int find_child(const CompactHead* h, char c)
+    {
+        for (size_t i = 0; i < h->nb_children; i++)
+            if (child(h, i)->label[0] == c)
+                return i;
+        return -1;
+    }
+};
+
+// Current layout: a versioned Header, then 4-byte aligned records with 32 bits
+// offsets and one byte label lengths. Longer labels are split over several
+// edges, the intermediate nodes having a null frequency. The children of a
+// node are sorted by decreasing max_freq, so the most frequent words come
+// first. The offsets of a CompactHead are followed by the first character of
+// the label of each child (padded up to the alignment), to find a child
+// without reading the CompactChild records.
+//
+// These keys are in the order of the children, not sorted: the top-k search
+// stops at the first child whose max_freq can't make the results, which
+// needs the max_freq order, and sorted keys would need a second array from
+// their rank to the child. find_child() compares them 16 at a time instead,
+// which covers almost every node in one step.
+//
+// Each CompactHead also bounds the words of its subtree, counting the label
+// of the edge leading to it: their lengths (up to 255) and the classes of
+// their characters (the 5 low bits of each byte), so that a search can leave
+// a subtree whose words are all too far from the query without walking it.
+//
+// The Header may point to a DeleteIndex after the trie (see delete-index.hh).
+// Its candidates are verified on their own words, so the index holds a copy
+// of every word with its frequency rather than a reference into the trie,
+// whose nodes can't be walked back to their words: about 20 bytes a word,
+// half the size of a trie of 100k words, but little next to the variants.
+//
+// The version is bumped whenever the records change, files of older versions
+// have to be compiled again.
+struct CompactFormat
+{
+    static constexpr uint32_t version = 6;
+    static constexpr size_t alignment = 4;
+    static constexpr size_t max_label_len = 255;
+    static constexpr bool bounded = true;
+    // A max_len of the words of a subtree which are longer
+    static constexpr size_t unbounded = 255;
+
+    struct Header
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t size;   // of the whole file
+        uint32_t root;   // offset of the root CompactHead
+        uint32_t index;  // offset of the DeleteIndex, 0 if there is none
+        uint32_t checksum; // of the bytes following the Header
+        uint32_t unused;
+    };
+
+    struct CompactHead
+    {
+        uint32_t freq;
+        uint32_t max_freq; // of the words of the subtree, this one included
+        uint16_t nb_children;
+        uint8_t min_len;   // of the words of the subtree, from the edge
+        uint8_t max_len;
+        uint32_t chars;    // bits of the classes of their characters
+        int32_t offset[1]; // offset from CompactHead address
+        // uint8_t keys[nb_children];
+    };
+
+    // Bit of the class of a character in CompactHead::chars
+    static uint32_t char_class(char c)
+    {
+        return uint32_t(1) << (c & 31);
+    }
+
+    // Bounds of a CompactHead being written, from the ones of its children
+    // and the label of the edge leading to it
+    struct Bounds
+    {
+        uint8_t min_len;
+        uint8_t max_len;
+        uint32_t chars;
+
+        static Bounds of_node(bool final)
+        {
+            return Bounds{uint8_t(final ? 0 : unbounded), 0, 0};
+        }
+
+        void add_child(const Bounds& child)
+        {
+            min_len = std::min(min_len, child.min_len);
+            max_len = std::max(max_len, child.max_len);
+            chars |= child.chars;
+        }
+
+        void add_label(const char* label, size_t len)
+        {
+            min_len = std::min(min_len + len, unbounded);
+            max_len = std::min(max_len + len, unbounded);
+            for (size_t i = 0; i < len; i++)
+                chars |= char_class(label[i]);
+        }
+    };
+
+    struct CompactChild
+    {
+        uint8_t label_len;
+        char label[1];
+    };
+
+    using node_t = const CompactHead*;
+    using edge_t = const CompactChild*;
+
+    static constexpr const char* magic = "OUIC";
+
+    static bool is(const char* start)
+    {
+        return !memcmp(start, magic, sizeof (Header::magic));
+    }
+
+    static const Header* header(const char* start)
+    {
+        return reinterpret_cast<const Header*>(start);
+    }
+
+    static const CompactHead* root(const char* start)
+    {
+        return reinterpret_cast<const CompactHead*>(
+                start + header(start)->root);
+    }
+
+    static size_t padding(size_t pos)
+    {
+        return (alignment - pos % alignment) % alignment;
+    }
+
+    static unsigned freq(const CompactHead* h)
+    {
+        return h->freq;
+    }
+
+    static unsigned max_freq(const CompactHead* h)
+    {
+        return h->max_freq;
+    }
+
+    static size_t nb_children(const CompactHead* h)
+    {
+        return h->nb_children;
+    }
+
+    static size_t min_len(const CompactHead* h)
+    {
+        return h->min_len;
+    }
+
+    static size_t max_len(const CompactHead* h)
+    {
+        return h->max_len == unbounded ? SIZE_MAX : h->max_len;
+    }
+
+    static uint32_t chars(const CompactHead* h)
+    {
+        return h->chars;
+    }
+
+    static const CompactChild* child(const CompactHead* h, size_t c)
+    {
+        return reinterpret_cast<const CompactChild*>(
+                reinterpret_cast<const char*>(h) + h->offset[c]);
+    }
+
+    static size_t label_len(const CompactChild* ch)
+    {
+        return ch->label_len;
+    }
+
+    static const char* label(const CompactChild* ch)
+    {
+        return ch->label;
+    }
+
+    // Its label and the start of its CompactHead
+    static void prefetch(const CompactChild* ch)
+    {
+        __builtin_prefetch(ch);
+    }
+
+    static const CompactHead* head(const CompactChild* ch)
+    {
+        // The CompactChild is aligned, so is the end of its padding
+        size_t end = 1 + ch->label_len;
+        return reinterpret_cast<const CompactHead*>(
+                reinterpret_cast<const char*>(ch) + end + padding(end));
+    }
+
+    static const char* keys(const CompactHead* h)
+    {
+        return reinterpret_cast<const char*>(h->offset + h->nb_children);
+    }
+
+    // Index of the child whose label starts with c, -1 if there is none
+    static int find_child(const CompactHead* h, char c)
+    {
+        const char* k = keys(h);
+        size_t n = h->nb_children;
+        size_t i = 0;
+#ifdef __SSE2__
+        // The keys are not sorted: compare them 16 at a time with c
+        __m128i needle = _mm_set1_epi8(c);
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i chunk = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(k + i));
+            int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+            if (mask)
+                return i + __builtin_ctz(mask);
+        }
+#endif
+        for (; i < n; i++)
+            if (k[i] == c)
+                return i;
+        return -1;
+    }
+};
+
+// Minimized layout: equivalent subtrees are stored once, so the nodes form an
+// acyclic automaton (a compacted DAWG) in which the words sharing a suffix
+// share the nodes of that suffix. A node can then be reached by several words,
+// its frequency cannot be stored in it: the frequencies are in an array indexed
+// by the rank of the words in byte order, and each CompactHead gives for each
+// of its children the number of words of the subtree coming before it.
+//
+// The records are the ones of CompactFormat, without max_freq, and written
+// children first so the offsets are negative. The children of a node are
+// sorted by label. Handles carry the rank of the first word of their subtree.
+struct CompactDawgFormat
+{
+    static constexpr uint32_t version = 2;
+    static constexpr size_t alignment = 4;
+    static constexpr size_t max_label_len = 255;
+    static constexpr uint32_t final_bit = 1u << 31;
+    static constexpr bool bounded = false;
+
+    struct Header
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t size;     // of the whole file
+        uint32_t root;     // offset of the root CompactHead
+        uint32_t freqs;    // offset of the uint32_t frequencies
+        uint32_t nb_words;
+        uint32_t checksum; // of the bytes following the Header
+    };
+
+    struct CompactHead
+    {
+        uint32_t info;     // final_bit | nb_children
+        int32_t offset[1]; // offset from CompactHead address
+        // uint32_t rank[nb_children];
+        // uint8_t keys[nb_children];
+    };
+
+    using CompactChild = CompactFormat::CompactChild;
+
+    struct node_t
+    {
+        const CompactHead* head;
+        const uint32_t* freqs;
+        uint32_t rank;
+    };
+
+    struct edge_t
+    {
+        const CompactChild* child;
+        const uint32_t* freqs;
+        uint32_t rank; // of the node it leads to
+    };
+
+    static constexpr const char* magic = "OUID";
+
+    static bool is(const char* start)
+    {
+        return !memcmp(start, magic, sizeof (Header::magic));
+    }
+
+    static const Header* header(const char* start)
+    {
+        return reinterpret_cast<const Header*>(start);
+    }
+
+    static node_t root(const char* start)
+    {
+        return node_t{
+            reinterpret_cast<const CompactHead*>(start + header(start)->root),
+            reinterpret_cast<const uint32_t*>(start + header(start)->freqs),
+            0
+        };
+    }
+
+    static size_t padding(size_t pos)
+    {
+        return CompactFormat::padding(pos);
+    }
+
+    static unsigned freq(node_t n)
+    {
+        return n.head->info & final_bit ? n.freqs[n.rank] : 0;
+    }
+
+    static unsigned max_freq(node_t)
+    {
+        return std::numeric_limits<unsigned>::max(); // shared subtrees
+    }
+
+    static size_t nb_children(node_t n)
+    {
+        return n.head->info & ~final_bit;
+    }
+
+    static const uint32_t* ranks(const CompactHead* h)
+    {
+        return reinterpret_cast<const uint32_t*>(
+                h->offset + (h->info & ~final_bit));
+    }
+
+    static const char* keys(const CompactHead* h)
+    {
+        return reinterpret_cast<const char*>(
+                ranks(h) + (h->info & ~final_bit));
+    }
+
+    static edge_t child(node_t n, size_t c)
+    {
+        return edge_t{
+            reinterpret_cast<const CompactChild*>(
+                    reinterpret_cast<const char*>(n.head) + n.head->offset[c]),
+            n.freqs,
+            n.rank + ranks(n.head)[c]
+        };
+    }
+
+    static size_t label_len(edge_t e)
+    {
+        return e.child->label_len;
+    }
+
+    static const char* label(edge_t e)
+    {
+        return e.child->label;
+    }
+
+    static void prefetch(edge_t e)
+    {
+        CompactFormat::prefetch(e.child);
+    }
+
+    static node_t head(edge_t e)
+    {
+        return node_t{
+            reinterpret_cast<const CompactHead*>(CompactFormat::head(e.child)),
+            e.freqs,
+            e.rank
+        };
+    }
+
+    // Index of the child whose label starts with c, -1 if there is none
+    static int find_child(node_t n, char c)
+    {
+        const char* k = keys(n.head);
+        size_t nb = nb_children(n);
+        for (size_t i = 0; i < nb && uint8_t(k[i]) <= uint8_t(c); i++)
+            if (k[i] == c)
+                return i;
+        return -1;
+    }
+};
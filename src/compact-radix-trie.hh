@@ -1,10 +1,26 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <unistd.h>
 
+#include "checksum.hh"
+#include "compact-format.hh"
 #include "damerau-levenshtein.hh"
+#include "damerau-levenshtein-batch.hh"
+#include "damerau-levenshtein-bitparallel.hh"
+#include "damerau-levenshtein-utf8.hh"
+#include "delete-index.hh"
+#include "edit-costs.hh"
+#include "query-arena.hh"
+#include "utf8.hh"
+#include "work-stealing-pool.hh"
 
 class CompactRadixTrie
 {
@@ -18,64 +34,1021 @@ public:
     };
     using matches_t = std::vector<match_t>;
 
-    struct CompactHead
+    using CompactHead = CompactFormat::CompactHead;
+    using CompactChild = CompactFormat::CompactChild;
+
+    // Whether the searches prefetch the nodes they visit next, unless built
+    // with -DNO_PREFETCH (./configure --without-prefetch)
+#ifdef NO_PREFETCH
+    static const bool prefetch_children = false;
+#else
+    static const bool prefetch_children = true;
+#endif
+
+    // Returns the format version of a compiled dictionary, 0 if it is invalid
+    static unsigned version(const char* start, size_t size)
     {
-        unsigned freq;
-        size_t nb_children;
-        size_t offset[1]; // offset from CompactHead address
-    } __attribute__((packed));
+        if (size >= sizeof (CompactDawgFormat::Header) &&
+            CompactDawgFormat::is(start))
+        {
+            const auto* header = CompactDawgFormat::header(start);
+            if (header->version != CompactDawgFormat::version ||
+                header->size != size ||
+                !root_fits_<CompactDawgFormat>(header->root, size) ||
+                header->freqs < sizeof (CompactDawgFormat::Header) ||
+                header->freqs + uint64_t(header->nb_words) * 4 > size)
+                return 0;
+            return CompactDawgFormat::version;
+        }
+        if (size >= sizeof (CompactFormat::Header) &&
+            CompactFormat::is(start))
+        {
+            const auto* header = CompactFormat::header(start);
+            if (header->version != CompactFormat::version ||
+                header->size != size ||
+                !root_fits_<CompactFormat>(header->root, size) ||
+                header->index % DeleteIndex::alignment ||
+                (header->index &&
+                 header->index + sizeof (DeleteIndex) > size))
+                return 0;
+            return CompactFormat::version;
+        }
+        return size >= sizeof (CompactFormatV1::CompactHead) - sizeof (size_t)
+            ? 1 : 0;
+    }
+
+    // Whether the checksum of a valid dictionary matches its content. This
+    // reads the whole file. Files of the first format have no checksum:
+    // their records are checked to make up the whole file instead.
+    static bool verify(const char* start, size_t size)
+    {
+        if (CompactFormat::is(start))
+            return verify_<CompactFormat>(start, size);
+        if (CompactDawgFormat::is(start))
+            return verify_<CompactDawgFormat>(start, size);
+        return verify_v1_(start, size);
+    }
+
+    // Returns the frequency of word, 0 if it is not in the dictionary
+    static unsigned lookup(const std::string& word, const char* start)
+    {
+        uint64_t nodes = 0;
+        return lookup(word, start, nodes);
+    }
+
+    // Same, adding the number of visited nodes to nodes
+    static unsigned lookup(const std::string& word, const char* start,
+                           uint64_t& nodes)
+    {
+        if (CompactFormat::is(start))
+            return lookup_<CompactFormat>(word, start, nodes);
+        if (CompactDawgFormat::is(start))
+            return lookup_<CompactDawgFormat>(word, start, nodes);
+        return lookup_<CompactFormatV1>(word, start, nodes);
+    }
+
+    // Calls f(word, freq) for each word of the dictionary, in the order of
+    // the nodes
+    template <typename Fn>
+    static void for_each_word(const char* start, Fn f)
+    {
+        std::string word;
+        if (CompactFormat::is(start))
+            for_each_word_<CompactFormat>(CompactFormat::root(start), word, f);
+        else if (CompactDawgFormat::is(start))
+            for_each_word_<CompactDawgFormat>(CompactDawgFormat::root(start),
+                                              word, f);
+        else
+            for_each_word_<CompactFormatV1>(CompactFormatV1::root(start),
+                                            word, f);
+    }
+
+    // No words added or deleted (see DictionaryOverlay)
+    struct no_overlay_t
+    {
+    };
+
+    // Leaves the sorted matches in arena.matches()
+    static void matches(QueryArena& arena, const std::string& word,
+                        const char* start, unsigned max_distance = 0)
+    {
+        matches(arena, word, start, max_distance, no_overlay_t());
+    }
+
+    // Same, with the words of overlay replacing the ones of the dictionary
+    template <typename O>
+    static void matches(QueryArena& arena, const std::string& word,
+                        const char* start, unsigned max_distance,
+                        const O& overlay)
+    {
+        arena.clear();
+        all_matches_t collector{arena};
+        search_(collector, arena, word, start, max_distance, overlay,
+                bytes_t());
+        arena.sort();
+    }
+
+    // Same as matches(), a walk of the trie handing a part of itself to pool
+    // each time it visited budget more nodes: the remaining children of its
+    // shallowest node are walked by a task, from a copy of the distance
+    // automaton at that node, and the tasks split the same way. Each task
+    // collects its own matches, merged with the others before sorting.
+    template <typename O>
+    static void parallel_matches(QueryArena& arena, const std::string& word,
+                                 const char* start, unsigned max_distance,
+                                 const O& overlay, WorkStealingPool& pool,
+                                 uint64_t budget)
+    {
+        arena.clear();
+        split_t split(pool, budget);
+        split_matches_t collector{arena, split, arena.stats().nodes + budget};
+        search_(collector, arena, word, start, max_distance, overlay,
+                bytes_t());
+        pool.wait([&split]() { return split.pending == 0; });
+        arena.merge(split.merged);
+        arena.sort();
+    }
+
+    // Leaves the k best matches within max_distance in arena.matches(). The
+    // distances are searched one after the other, and a search stops
+    // exploring the subtrees whose words are all less frequent than the k-th
+    // best match so far.
+    static void top_matches(QueryArena& arena, const std::string& word,
+                            const char* start, unsigned k,
+                            unsigned max_distance = 0)
+    {
+        top_matches(arena, word, start, k, max_distance, no_overlay_t());
+    }
+
+    // Same, with the words of overlay replacing the ones of the dictionary
+    template <typename O>
+    static void top_matches(QueryArena& arena, const std::string& word,
+                            const char* start, unsigned k,
+                            unsigned max_distance, const O& overlay)
+    {
+        top_matches_(arena, word, start, k, max_distance, overlay, bytes_t());
+    }
+
+    // Same as matches(), the distances being computed on the code points of
+    // the UTF-8 words rather than on their bytes. The deletion index, whose
+    // variants are missing bytes, is not used.
+    template <typename O>
+    static void utf8_matches(QueryArena& arena, const std::string& word,
+                             const char* start, unsigned max_distance,
+                             const O& overlay)
+    {
+        arena.clear();
+        all_matches_t collector{arena};
+        search_(collector, arena, word, start, max_distance, overlay,
+                utf8_t());
+        arena.sort();
+    }
+
+    template <typename O>
+    static void utf8_top_matches(QueryArena& arena, const std::string& word,
+                                 const char* start, unsigned k,
+                                 unsigned max_distance, const O& overlay)
+    {
+        top_matches_(arena, word, start, k, max_distance, overlay, utf8_t());
+    }
+
+    // Same as matches(), with the distances weighted by costs: they are in
+    // EditCostTable::unit, as max_cost. The deletion index, which only
+    // knows about unit costs, is not used.
+    template <typename O>
+    static void weighted_matches(QueryArena& arena, const std::string& word,
+                                 const char* start, unsigned max_cost,
+                                 const EditCostTable& costs,
+                                 const O& overlay)
+    {
+        arena.clear();
+        all_matches_t collector{arena};
+        search_(collector, arena, word, start, max_cost, overlay,
+                weighted_t{costs});
+        arena.sort();
+    }
 
-    struct CompactChild
+    // The k best matches of weighted_matches(): the weighted distances are
+    // not searched one after the other, as there are too many of them
+    template <typename O>
+    static void weighted_top_matches(QueryArena& arena,
+                                     const std::string& word,
+                                     const char* start, unsigned k,
+                                     unsigned max_cost,
+                                     const EditCostTable& costs,
+                                     const O& overlay)
     {
-        size_t label_len;
-        char label[1];
-    } __attribute__((packed));
+        weighted_matches(arena, word, start, max_cost, costs, overlay);
+        if (arena.matches().size() > k)
+            arena.matches().resize(k);
+    }
+
+    // A query of batch_matches()
+    struct batch_query_t
+    {
+        QueryArena* arena;
+        const std::string* word;
+        unsigned max_distance;
+    };
+
+    // Queries walking the trie together in batch_matches()
+    static constexpr size_t batch_group_size =
+        BatchDamerauLevenshtein::max_queries;
+
+    // Same as matches() for each query, leaving its matches in its arena.
+    // The queries that have to walk the trie are sorted, so that the words
+    // sharing a prefix are together, and cut in groups walking the trie
+    // once: each node is decoded once for the group, and a query leaves the
+    // walk of a subtree as soon as its automaton rejects it.
+    static void batch_matches(std::vector<batch_query_t>& queries,
+                              const char* start)
+    {
+        std::vector<batch_query_t*> walking;
+        for (auto& q : queries)
+        {
+            // Exact, long or indexed queries don't walk the trie
+            if (q.max_distance == 0 ||
+                q.word->size() > BatchDamerauLevenshtein::max_word_size ||
+                indexed_(start, q.max_distance))
+                matches(*q.arena, *q.word, start, q.max_distance);
+            else
+                walking.push_back(&q);
+        }
+        std::sort(walking.begin(), walking.end(),
+                  [](const batch_query_t* a, const batch_query_t* b) {
+                      return *a->word < *b->word;
+                  });
+
+        for (size_t g = 0; g < walking.size(); g += batch_group_size)
+        {
+            size_t n = std::min(batch_group_size, walking.size() - g);
+            if (CompactFormat::is(start))
+                walk_group_<CompactFormat>(&walking[g], n,
+                                           CompactFormat::root(start));
+            else if (CompactDawgFormat::is(start))
+                walk_group_<CompactDawgFormat>(&walking[g], n,
+                        CompactDawgFormat::root(start));
+            else
+                walk_group_<CompactFormatV1>(&walking[g], n,
+                                             CompactFormatV1::root(start));
+        }
+    }
 
     static matches_t matches(const std::string& word, const char* start,
                              unsigned max_distance = 0)
+    {
+        QueryArena arena;
+        matches(arena, word, start, max_distance);
+        return to_matches_(arena);
+    }
+
+    static matches_t top_matches(const std::string& word, const char* start,
+                                 unsigned k, unsigned max_distance = 0)
+    {
+        QueryArena arena;
+        top_matches(arena, word, start, k, max_distance);
+        return to_matches_(arena);
+    }
+
+private:
+    using match_ref_t = QueryArena::match_ref_t;
+
+    // Collects every match
+    struct all_matches_t
+    {
+        static const bool splits = false; // see split_matches_t
+
+        QueryArena& arena;
+
+        bool prune(unsigned) const
+        {
+            return false;
+        }
+
+        void add(const std::string& word, unsigned distance, unsigned freq)
+        {
+            arena.add(word, distance, freq);
+        }
+    };
+
+    // Keeps the k best matches at a given distance in a bounded heap, whose
+    // top is the worst of them
+    struct top_matches_t
+    {
+        static const bool splits = false;
+
+        QueryArena& arena;
+        size_t k;
+        unsigned distance;
+
+        bool prune(unsigned max_freq) const
+        {
+            const auto& heap = arena.heap();
+            return heap.size() == k && max_freq < heap.front().freq;
+        }
+
+        void add(const std::string& word, unsigned dist, unsigned freq)
+        {
+            if (dist != distance) // found while searching a lower distance
+                return;
+            auto& heap = arena.heap();
+            auto better = [this](const match_ref_t& a, const match_ref_t& b) {
+                return arena.better(a, b);
+            };
+            if (heap.size() == k)
+            {
+                const match_ref_t& worst = heap.front();
+                if (freq < worst.freq ||
+                    (freq == worst.freq && word >= arena.word(worst)))
+                    return;
+                std::pop_heap(heap.begin(), heap.end(), better);
+                heap.pop_back();
+            }
+            heap.push_back(arena.store(word, dist, freq));
+            std::push_heap(heap.begin(), heap.end(), better);
+        }
+
+        // Moves the matches, sorted, at the end of arena.matches()
+        void finish()
+        {
+            auto& heap = arena.heap();
+            std::sort(heap.begin(), heap.end(),
+                      [this](const match_ref_t& a, const match_ref_t& b) {
+                          return arena.better(a, b);
+                      });
+            auto& res = arena.matches();
+            res.insert(res.end(), heap.begin(), heap.end());
+            heap.clear();
+        }
+    };
+
+    // Passes the matches of the dictionary to another collector, except the
+    // words of the overlay
+    template <typename C, typename O>
+    struct overlay_filter_t
+    {
+        static const bool splits = false;
+
+        QueryArena& arena;
+        C& collector;
+        const O& overlay;
+
+        bool prune(unsigned max_freq) const
+        {
+            return collector.prune(max_freq);
+        }
+
+        void add(const std::string& word, unsigned distance, unsigned freq)
+        {
+            unsigned overlay_freq;
+            if (!overlay.find(word, overlay_freq))
+                collector.add(word, distance, freq);
+        }
+    };
+
+    // Passes the matches of a segment of the overlay to another collector,
+    // except the words a newer segment replaces
+    template <typename C, typename O>
+    struct segment_filter_t
+    {
+        static const bool splits = false;
+
+        QueryArena& arena;
+        C& collector;
+        const O& overlay;
+        size_t segment;
+
+        bool prune(unsigned max_freq) const
+        {
+            return collector.prune(max_freq);
+        }
+
+        void add(const std::string& word, unsigned distance, unsigned freq)
+        {
+            if (!overlay.shadowed(segment, word))
+                collector.add(word, distance, freq);
+        }
+    };
+
+    // Shared by the tasks of parallel_matches()
+    struct split_t
+    {
+        split_t(WorkStealingPool& pool, uint64_t budget)
+          : pool(pool)
+          , budget(budget)
+          , pending(0)
+          , mutex()
+          , merged()
+        {
+        }
+
+        WorkStealingPool& pool;
+        uint64_t budget; // nodes visited between two splits
+        std::atomic<size_t> pending; // tasks not finished yet
+        std::mutex mutex;
+        QueryArena merged; // matches of the finished tasks
+    };
+
+    // Collects every match, as all_matches_t, the walk calling split_() once
+    // arena.stats().nodes reaches until
+    struct split_matches_t
+    {
+        static const bool splits = true;
+
+        QueryArena& arena;
+        split_t& split;
+        uint64_t until;
+
+        bool prune(unsigned) const
+        {
+            return false;
+        }
+
+        void add(const std::string& word, unsigned distance, unsigned freq)
+        {
+            arena.add(word, distance, freq);
+        }
+    };
+
+    static matches_t to_matches_(const QueryArena& arena)
     {
         matches_t res;
-        DamerauLevenshtein dl(word, max_distance);
-        matches_(res, dl, start);
-        std::sort(res.begin(), res.end(), [](match_t a, match_t b) -> bool {
-                if (a.distance != b.distance)
-                    return (a.distance < b.distance);
-                if (b.freq != a.freq)
-                    return (b.freq < a.freq);
-                return (a.word.compare(b.word) < 0);
-                });
+        res.reserve(arena.matches().size());
+        for (const auto& m : arena.matches())
+            res.push_back(match_t{std::string(arena.word(m)), m.distance,
+                                  m.freq});
         return res;
     }
 
-    static void matches_(matches_t& res, DamerauLevenshtein& dl,
-            const char* start)
+    // How search_() computes the distances, and whether it can look the
+    // exact words up and use the deletion index instead. On bytes:
+    struct bytes_t
+    {
+        static const bool exact_lookup = true;
+        static const bool deletion_index = true;
+
+        template <typename F, typename C>
+        void search_in(C& collector, QueryArena& arena,
+                       const std::string& word, typename F::node_t root,
+                       unsigned max_distance) const
+        {
+            // The bit-parallel automaton is faster than the table but
+            // limited to 64 characters. The fixed band is faster than both
+            // at small distances, only up to 1 for the former.
+            bool short_word =
+                word.size() <= BitParallelDamerauLevenshtein::max_word_size;
+            if (max_distance <= (short_word ? 1
+                                 : QueryArena::max_fixed_distance))
+                search_fixed_<F>(collector, arena, word, root, max_distance);
+            else if (short_word)
+            {
+                auto& dl = arena.bit_parallel(word, max_distance);
+                matches_<F>(collector, dl, root);
+                arena.stats().cells += dl.cells();
+            }
+            else
+            {
+                auto& dl = arena.table(word, max_distance);
+                matches_<F>(collector, dl, root);
+                arena.stats().cells += dl.cells();
+            }
+        }
+
+        // With FixedDamerauLevenshtein<N>, for N = max_distance
+        template <typename F, typename C, unsigned N = 0>
+        static void search_fixed_(C& collector, QueryArena& arena,
+                                  const std::string& word,
+                                  typename F::node_t root,
+                                  unsigned max_distance)
+        {
+            if constexpr (N < QueryArena::max_fixed_distance)
+                if (max_distance != N)
+                    return search_fixed_<F, C, N + 1>(collector, arena, word,
+                                                      root, max_distance);
+            auto& dl = arena.fixed<N>(word);
+            matches_<F>(collector, dl, root);
+            arena.stats().cells += dl.cells();
+        }
+    };
+
+    // On code points
+    struct utf8_t
+    {
+        static const bool exact_lookup = true;
+        static const bool deletion_index = false;
+
+        template <typename F, typename C>
+        void search_in(C& collector, QueryArena& arena,
+                       const std::string& word, typename F::node_t root,
+                       unsigned max_distance) const
+        {
+            if (Utf8::size(word) <= Utf8DamerauLevenshtein::max_word_size)
+            {
+                auto& dl = arena.utf8(word, max_distance);
+                matches_<F>(collector, dl, root);
+                arena.stats().cells += dl.cells();
+            }
+            else
+            {
+                auto& dl = arena.code_points(word, max_distance);
+                matches_<F>(collector, dl, root);
+                arena.stats().cells += dl.cells();
+            }
+        }
+    };
+
+    // Weighted by costs, on code points: even the exact queries walk the
+    // trie, as some edits may cost nothing
+    struct weighted_t
+    {
+        static const bool exact_lookup = false;
+        static const bool deletion_index = false;
+
+        const EditCostTable& costs;
+
+        template <typename F, typename C>
+        void search_in(C& collector, QueryArena& arena,
+                       const std::string& word, typename F::node_t root,
+                       unsigned max_cost) const
+        {
+            auto& dl = arena.weighted(word, max_cost, costs);
+            matches_<F>(collector, dl, root);
+            arena.stats().cells += dl.cells();
+        }
+    };
+
+    template <typename O, typename D>
+    static void top_matches_(QueryArena& arena, const std::string& word,
+                             const char* start, unsigned k,
+                             unsigned max_distance, const O& overlay,
+                             const D& distance)
+    {
+        arena.clear();
+        for (unsigned d = 0; d <= max_distance && arena.matches().size() < k;
+             d++)
+        {
+            top_matches_t collector{arena, k - arena.matches().size(), d};
+            search_(collector, arena, word, start, d, overlay, distance);
+            collector.finish();
+        }
+    }
+
+    template <typename C, typename O, typename D>
+    static void search_(C& collector, QueryArena& arena,
+                        const std::string& word, const char* start,
+                        unsigned max_distance, const O& overlay,
+                        const D& distance)
     {
-        const CompactHead* h = reinterpret_cast<const CompactHead*>(start);
-        unsigned baselen = dl.current().size();
-        for (size_t c = 0; c < h->nb_children; ++c)
+        if (!overlay.empty())
         {
-            dl.rollback(baselen);
-            matches_edge_(res, dl, start + h->offset[c]);
+            overlay_filter_t<C, O> filter{arena, collector, overlay};
+            search_(filter, arena, word, start, max_distance, no_overlay_t(),
+                    distance);
+            search_overlay_(collector, arena, word, max_distance, overlay,
+                            distance);
+            return;
         }
+        search_(collector, arena, word, start, max_distance, no_overlay_t(),
+                distance);
     }
 
-    static void matches_edge_(matches_t& res, DamerauLevenshtein& dl,
-                              const char* start)
+    template <typename C, typename D>
+    static void search_(C& collector, QueryArena& arena,
+                        const std::string& word, const char* start,
+                        unsigned max_distance, no_overlay_t,
+                        const D& distance)
+    {
+        // Exact matches only need a descent, no distance computation
+        if (D::exact_lookup && max_distance == 0)
+        {
+            unsigned freq = lookup(word, start, arena.stats().nodes);
+            if (freq)
+                collector.add(word, 0, freq);
+            return;
+        }
+
+        // Low distances are cheaper to answer with the deletion index
+        if (D::deletion_index && CompactFormat::is(start))
+        {
+            const auto* index = DeleteIndex::get(
+                    start, CompactFormat::header(start)->index);
+            if (index && max_distance <= index->depth)
+            {
+                search_index_(collector, arena, *index, word, max_distance);
+                return;
+            }
+        }
+
+        if (CompactFormat::is(start))
+            distance.template search_in<CompactFormat>(
+                    collector, arena, word, CompactFormat::root(start),
+                    max_distance);
+        else if (CompactDawgFormat::is(start))
+            distance.template search_in<CompactDawgFormat>(
+                    collector, arena, word, CompactDawgFormat::root(start),
+                    max_distance);
+        else
+            distance.template search_in<CompactFormatV1>(
+                    collector, arena, word, CompactFormatV1::root(start),
+                    max_distance);
+    }
+
+    // Adds the words of the overlay within the distance
+    template <typename C, typename O, typename D>
+    static void search_overlay_(C& collector, QueryArena& arena,
+                                const std::string& word,
+                                unsigned max_distance, const O& overlay,
+                                const D& distance)
+    {
+        unsigned freq;
+        if (D::exact_lookup && max_distance == 0)
+        {
+            if (overlay.find(word, freq) && freq)
+                collector.add(word, 0, freq);
+            return;
+        }
+        for (size_t s = 0; s < overlay.nb_segments(); s++)
+        {
+            segment_filter_t<C, O> filter{arena, collector, overlay, s};
+            distance.template search_in<typename O::format_t>(
+                    filter, arena, word, overlay.root(s), max_distance);
+        }
+    }
+
+    // Whether the deletion index answers the queries within max_distance
+    static bool indexed_(const char* start, unsigned max_distance)
+    {
+        if (!CompactFormat::is(start))
+            return false;
+        const auto* index = DeleteIndex::get(
+                start, CompactFormat::header(start)->index);
+        return index && max_distance <= index->depth;
+    }
+
+    template <typename F>
+    static void walk_group_(batch_query_t* const* group, size_t n,
+                            typename F::node_t root)
+    {
+        static thread_local BatchDamerauLevenshtein dl;
+        static thread_local std::string path;
+        const std::string* words[batch_group_size];
+        unsigned max_distances[batch_group_size];
+        for (size_t q = 0; q < n; q++)
+        {
+            group[q]->arena->clear();
+            words[q] = group[q]->word;
+            max_distances[q] = group[q]->max_distance;
+        }
+        path.clear();
+        auto all = dl.reset(words, max_distances, n);
+
+        walk_<F>(group, dl, path, all, root);
+
+        for (size_t q = 0; q < n; q++)
+        {
+            group[q]->arena->stats().cells += dl.cells(q);
+            group[q]->arena->sort();
+        }
+    }
+
+    // Walks the subtree of h with the queries of active, path leading to h
+    template <typename F>
+    static void walk_(batch_query_t* const* group,
+                      BatchDamerauLevenshtein& dl, std::string& path,
+                      BatchDamerauLevenshtein::mask_t active,
+                      typename F::node_t h)
     {
-        const CompactChild* ch = reinterpret_cast<const CompactChild*>(start);
-        const char* caddr = start + sizeof (size_t) + ch->label_len;
-        const CompactHead* chead = reinterpret_cast<const CompactHead*>(caddr);
+        size_t len = path.size();
+        for (size_t c = 0; c < F::nb_children(h); ++c)
+        {
+            auto ch = F::child(h, c);
+            const char* label = F::label(ch);
+            size_t label_len = F::label_len(ch);
+            for (auto m = active; m; m &= m - 1)
+                group[__builtin_ctz(m)]->arena->stats().nodes++;
+
+            auto alive = active;
+            for (size_t i = 0; i < label_len && alive; i++)
+                alive = dl.feed(label[i], len + i, alive);
+            if (!alive)
+                continue;
+
+            auto chead = F::head(ch);
+            path.append(label, label_len);
+            if (F::freq(chead) != 0)
+                for (auto m = dl.accepting(path.size(), alive); m;
+                     m &= m - 1)
+                {
+                    size_t q = __builtin_ctz(m);
+                    group[q]->arena->add(path, dl.dist(path.size(), q),
+                                         F::freq(chead));
+                }
+            walk_<F>(group, dl, path, alive, chead);
+            path.resize(len);
+        }
+    }
+
+    // Whether the fixed part of the root CompactHead is in the file, after
+    // the Header
+    template <typename F>
+    static bool root_fits_(uint32_t root, size_t size)
+    {
+        return root >= sizeof (typename F::Header) &&
+            root % F::alignment == 0 &&
+            root + offsetof(typename F::CompactHead, offset) <= size;
+    }
+
+    template <typename F>
+    static bool verify_(const char* start, size_t size)
+    {
+        using Header = typename F::Header;
+        return F::header(start)->checksum ==
+            Checksum::of(start + sizeof (Header), size - sizeof (Header));
+    }
+
+    // The first format is written depth first without gaps: each child
+    // starts where the subtree of the previous one ends, and the last one
+    // ends the file
+    static bool verify_v1_(const char* start, size_t size)
+    {
+        using Head = CompactFormatV1::CompactHead;
+        const size_t fixed = offsetof(Head, offset);
+        struct frame_t
+        {
+            size_t head;
+            size_t nb_children;
+            size_t next;
+        };
+        std::vector<frame_t> stack;
+        size_t pos = 0;
+        auto read = [&](size_t at) {
+            size_t value;
+            memcpy(&value, start + at, sizeof (value));
+            return value;
+        };
+        auto push_head = [&]() {
+            if (size - pos < fixed)
+                return false;
+            size_t n = read(pos + offsetof(Head, nb_children));
+            if (n > (size - pos - fixed) / sizeof (size_t))
+                return false;
+            stack.push_back(frame_t{pos, n, 0});
+            pos += fixed + n * sizeof (size_t);
+            return true;
+        };
+
+        if (!push_head())
+            return false;
+        while (!stack.empty())
+        {
+            frame_t& f = stack.back();
+            if (f.next == f.nb_children)
+            {
+                stack.pop_back();
+                continue;
+            }
+            size_t offset = read(f.head + fixed + f.next++ * sizeof (size_t));
+            if (offset != pos - f.head || size - pos < sizeof (size_t))
+                return false;
+            size_t len = read(pos);
+            pos += sizeof (size_t);
+            if (!len || len > size - pos)
+                return false;
+            pos += len;
+            if (!push_head())
+                return false;
+        }
+        return pos == size;
+    }
+
+    template <typename C>
+    static void search_index_(C& collector, QueryArena& arena,
+                              const DeleteIndex& index,
+                              const std::string& word, unsigned max_distance)
+    {
+        auto& candidates = arena.candidates();
+        candidates.clear();
+        DeleteIndex::for_each_variant(word, index.prefix, max_distance,
+                arena.scratch(), [&](const std::string& v) {
+                    index.probe(DeleteIndex::hash(v.data(), v.size()),
+                                candidates);
+                });
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()),
+                         candidates.end());
+        arena.stats().nodes += candidates.size();
+
+        if (word.size() <= BitParallelDamerauLevenshtein::max_word_size)
+        {
+            auto& dl = arena.bit_parallel(word, max_distance);
+            verify_<C>(collector, dl, index, candidates);
+            arena.stats().cells += dl.cells();
+        }
+        else
+        {
+            auto& dl = arena.table(word, max_distance);
+            verify_<C>(collector, dl, index, candidates);
+            arena.stats().cells += dl.cells();
+        }
+    }
+
+    // Adds the candidates within the distance, fed as if they were found in
+    // the trie
+    template <typename C, typename DL>
+    static void verify_(C& collector, DL& dl, const DeleteIndex& index,
+                        const std::vector<uint32_t>& candidates)
+    {
+        for (auto c : candidates)
+        {
+            dl.rollback(0);
+            const char* w = index.word(c);
+            size_t len = index.len(c);
+            bool accept = false;
+            size_t i = 0;
+            for (; i < len; i++)
+            {
+                auto res_feed = dl.feed(w[i]);
+                if (!res_feed.first)
+                    break;
+                accept = res_feed.second;
+            }
+            if (i == len && accept)
+                collector.add(dl.current(), dl.dist(), index.freq(c));
+        }
+    }
+
+    template <typename F>
+    static unsigned lookup_(const std::string& word, const char* start,
+                            uint64_t& nodes)
+    {
+        auto h = F::root(start);
+        size_t pos = 0;
+        while (pos < word.size())
+        {
+            nodes++;
+            int c = F::find_child(h, word[pos]);
+            if (c < 0)
+                return 0;
+            auto ch = F::child(h, c);
+            size_t len = F::label_len(ch);
+            if (word.size() - pos < len ||
+                memcmp(F::label(ch), word.data() + pos, len))
+                return 0;
+            pos += len;
+            h = F::head(ch);
+        }
+        return F::freq(h);
+    }
+
+    template <typename F, typename Fn>
+    static void for_each_word_(typename F::node_t h, std::string& word,
+                               Fn& f)
+    {
+        if (F::freq(h))
+            f(word, F::freq(h));
+        size_t len = word.size();
+        for (size_t c = 0; c < F::nb_children(h); ++c)
+        {
+            auto ch = F::child(h, c);
+            word.append(F::label(ch), F::label_len(ch));
+            for_each_word_<F>(F::head(ch), word, f);
+            word.resize(len);
+        }
+    }
+
+    // A node of the path being walked by matches_(), with the length of the
+    // word leading to it and its next child
+    template <typename F>
+    struct frame_t
+    {
+        typename F::node_t h;
+        size_t c;
+        unsigned baselen;
+    };
+
+    // Walks the subtree of h depth first, with an explicit stack of the
+    // nodes of the path. Once the label of a child matched, the records of
+    // its own children are prefetched (see prefetch_children): they are far
+    // from each other, but all read one after the other to be pruned, so
+    // their cache misses overlap instead of stalling the walk one by one.
+    template <typename F, typename C, typename DL>
+    static void matches_(C& collector, DL& dl,
+                         typename F::node_t h)
+    {
+        matches_from_<F>(collector, dl,
+                         frame_t<F>{h, 0, unsigned(dl.current().size())});
+    }
+
+    // Same, from the child first.c of first.h, after its previous siblings
+    template <typename F, typename C, typename DL>
+    static void matches_from_(C& collector, DL& dl, frame_t<F> first)
+    {
+        // Above base, as a collector may search another trie
+        static thread_local std::vector<frame_t<F>> stack;
+        size_t base = stack.size();
+        stack.push_back(first);
+        while (stack.size() > base)
+        {
+            if constexpr (C::splits)
+                if (collector.arena.stats().nodes >= collector.until)
+                    split_<F>(collector, dl, stack, base);
+            frame_t<F>& f = stack.back();
+            size_t nb = F::nb_children(f.h);
+            if (f.c == nb)
+            {
+                stack.pop_back();
+                continue;
+            }
+            size_t c = f.c++;
+            auto ch = F::child(f.h, c);
+            auto chead = F::head(ch);
+            // The next siblings have an even lower max_freq
+            if (collector.prune(F::max_freq(chead)))
+            {
+                stack.pop_back();
+                continue;
+            }
+            dl.rollback(f.baselen);
+            // Or every word of its subtree is too far
+            if constexpr (F::bounded)
+                if (!dl.reachable(F::min_len(chead), F::max_len(chead),
+                                  F::chars(chead)))
+                    continue;
+            collector.arena.stats().nodes++;
+            if (matches_edge_<F>(collector, dl, ch, chead))
+            {
+                if constexpr (prefetch_children)
+                    for (size_t g = 0; g < F::nb_children(chead); g++)
+                        F::prefetch(F::child(chead, g));
+                stack.push_back(frame_t<F>{chead, 0,
+                                           unsigned(dl.current().size())});
+            }
+        }
+    }
+
+    // Hands the remaining children of the shallowest node of the walk that
+    // has some to a task of the pool, the walk going on with the others
+    template <typename F, typename DL>
+    static void split_(split_matches_t& collector, DL dl,
+                       std::vector<frame_t<F>>& stack, size_t base)
+    {
+        split_t& split = collector.split;
+        collector.until = collector.arena.stats().nodes + split.budget;
+        for (size_t s = base; s < stack.size(); s++)
+        {
+            frame_t<F>& f = stack[s];
+            if (f.c == F::nb_children(f.h))
+                continue;
+            auto task = [&split, dl = std::move(dl), rest = f]() mutable {
+                split_task_<F>(split, dl, rest);
+            };
+            split.pending++;
+            split.pool.submit(std::move(task));
+            f.c = F::nb_children(f.h);
+            return;
+        }
+    }
+
+    // Walks the children of first from first.c on, dl being a copy of the
+    // automaton of the walk that split
+    template <typename F, typename DL>
+    static void split_task_(split_t& split, DL& dl, frame_t<F> first)
+    {
+        static thread_local QueryArena arena;
+        arena.clear();
+        arena.stats() = QueryArena::stats_t{0, 0};
+        uint64_t cells = dl.cells();
+        dl.rollback(first.baselen);
+        split_matches_t collector{arena, split, split.budget};
+        matches_from_<F>(collector, dl, first);
+        arena.stats().cells += dl.cells() - cells;
+        {
+            std::lock_guard<std::mutex> lock(split.mutex);
+            split.merged.merge(arena);
+        }
+        // split is gone once the search sees no pending task
+        WorkStealingPool& pool = split.pool;
+        if (--split.pending == 0)
+            pool.notify();
+    }
+
+    // Feeds the label of ch, returns whether its subtree may match
+    template <typename F, typename C, typename DL>
+    static bool matches_edge_(C& collector, DL& dl, typename F::edge_t ch,
+                              typename F::node_t chead)
+    {
+        const char* label = F::label(ch);
+        size_t label_len = F::label_len(ch);
         bool accept = false;
-        for (size_t i = 0; i < ch->label_len; i++)
+        for (size_t i = 0; i < label_len; i++)
         {
-            char c = ch->label[i];
-            auto res_feed = dl.feed(c);
+            auto res_feed = dl.feed(label[i]);
             if (!res_feed.first)
-                return;
+                return false;
             accept = res_feed.second;
         }
-        if (accept && chead->freq != 0)
-            res.push_back(match_t{dl.current(), dl.dist(), chead->freq});
-        matches_(res, dl, caddr);
+        if (accept && F::freq(chead) != 0)
+            collector.add(dl.current(), dl.dist(), F::freq(chead));
+        return true;
     }
 };
@@ -1,39 +1,273 @@
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <iterator>
+#include <string>
 
+#include "compact-builder.hh"
+#include "dictionary-overlay.hh"
+#include "dictionary.hh"
+#include "external-sort.hh"
 #include "radix-trie.hh"
+#include "tokenizer.hh"
 
-int main(int argc, char *argv[])
+void usage(const char* name)
+{
+    std::cout << "Usage: " << name << " [--layout=dfs|bfs|veb"
+        " [--delete-index=D [--delete-prefix=N]] | --dawg"
+        " | --streaming [--sorted] [--memory=MB]] [--threads=N]"
+        " /path/to/word/freq.txt /path/to/output/dict.bin" << std::endl;
+    std::cout << "       " << name << " [options] --merge"
+        " /path/to/compiled/dict.bin /path/to/delta.log"
+        " /path/to/output/dict.bin" << std::endl;
+    std::abort();
+}
+
+// Calls f(word, freq) for each line of the word list in, skipping the blank
+// ones, as long as f returns true. Fails on the first malformed line, as
+// RadixTrie::load.
+template <typename Fn>
+bool read_lines(std::istream& in, const char* path, Fn f)
 {
-    if (argc < 3)
+    std::string line;
+    while (std::getline(in, line))
     {
-        std::cout << "Usage: " << argv[0] <<
-            " /path/to/word/freq.txt /path/to/output/dict.bin" << std::endl;
-        std::abort();
+        size_t pos = 0;
+        unsigned freq;
+        std::string_view word = next_token(line, pos);
+        if (word.empty())
+            continue;
+        if (!parse_number(next_token(line, pos), freq) ||
+            !next_token(line, pos).empty())
+        {
+            std::cerr << path << ": Malformed line: " << line << std::endl;
+            return false;
+        }
+        if (!f(std::string(word), freq))
+            return true;
     }
+    return true;
+}
 
-    std::cout << "Size structure: " << 4 << std::endl; //FIXME(seirl): wtf
+// Calls f(word, freq) for the words of a compiled dictionary, then for the
+// commands of the log of the app, with a freq of 0 for the deletions
+template <typename Fn>
+bool read_merge(const char* dict_path, const char* log_path, Fn f)
+{
+    std::string error;
+    auto dict = Dictionary::open(dict_path, error, true);
+    if (!dict)
+    {
+        std::cerr << error << std::endl;
+        return false;
+    }
+    std::ifstream log_f(log_path);
+    if (!log_f.is_open())
+    {
+        std::cerr << "File not found: " << log_path << std::endl;
+        return false;
+    }
 
-    std::string line;
-    std::ifstream words_f(argv[1]);
-    if (!words_f.is_open())
+    CompactRadixTrie::for_each_word(dict->start(), f);
+    if (!DictionaryOverlay::read_log(log_f, f))
+    {
+        std::cerr << "Malformed log: " << log_path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Builds the dictionary without loading the whole trie in memory. Unless the
+// words are already sorted, they are sorted with at most memory bytes.
+// read_words(f) calls f(word, freq) for each word, unless they are sorted:
+// then they are read from in, the file at path.
+template <typename Fn>
+int compile_streaming(std::istream& in, const char* path, std::ostream& out,
+                      bool sorted, size_t memory, Fn read_words)
+{
+    CompactBuilder builder(out);
+    std::string word;
+    unsigned freq;
+
+    if (sorted)
+    {
+        if (!read_lines(in, path, [&](const std::string& w, unsigned f) {
+                    return builder.add(w, f);
+                }))
+            return 1;
+    }
+    else
     {
-        std::cerr << "File not found: " << argv[1] << std::endl;
+        ExternalSorter sorter(memory);
+        bool ok = true;
+        if (!read_words([&](const std::string& w, unsigned f) {
+                ok = ok && sorter.add(w, f);
+            }))
+            return 1;
+        // The last frequency of a word wins, and 0 deletes it, so a word is
+        // only added once the next one is seen
+        bool pending = false;
+        ok = ok && sorter.merge([&](const std::string& w, unsigned f) {
+                if (pending && w != word && freq)
+                    builder.add(word, freq);
+                pending = true;
+                word = w;
+                freq = f;
+        });
+        if (pending && freq)
+            builder.add(word, freq);
+        if (!ok)
+        {
+            std::cerr << "Could not write temporary files" << std::endl;
+            return 1;
+        }
+    }
+    if (!builder.finish())
+    {
+        std::cerr << builder.error() << std::endl;
         return 1;
     }
+    return 0;
+}
 
-    auto trie = std::make_unique<RadixTrie>();
-    trie->load(words_f);
-    words_f.close();
+int main(int argc, char *argv[])
+{
+    CompactLayout layout = CompactLayout::dfs;
+    bool dawg = false;
+    bool streaming = false;
+    bool sorted = false;
+    bool merge = false;
+    size_t memory = 256;
+    unsigned index_depth = 0;
+    size_t index_prefix = 0;
+    unsigned nb_threads = ThreadPool::default_size();
+    std::vector<const char*> paths;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--layout=dfs"))
+            layout = CompactLayout::dfs;
+        else if (!strcmp(argv[i], "--layout=bfs"))
+            layout = CompactLayout::bfs;
+        else if (!strcmp(argv[i], "--layout=veb"))
+            layout = CompactLayout::veb;
+        else if (!strcmp(argv[i], "--dawg"))
+            dawg = true;
+        else if (!strcmp(argv[i], "--streaming"))
+            streaming = true;
+        else if (!strcmp(argv[i], "--merge"))
+            merge = true;
+        else if (!strcmp(argv[i], "--sorted"))
+            sorted = true;
+        else if (!strncmp(argv[i], "--memory=", 9))
+            memory = std::strtoul(argv[i] + 9, nullptr, 10);
+        else if (!strncmp(argv[i], "--delete-index=", 15))
+            index_depth = std::strtoul(argv[i] + 15, nullptr, 10);
+        else if (!strncmp(argv[i], "--delete-prefix=", 16))
+            index_prefix = std::strtoul(argv[i] + 16, nullptr, 10);
+        else if (!strncmp(argv[i], "--threads=", 10))
+        {
+            // 0 means one thread per core
+            nb_threads = std::strtoul(argv[i] + 10, nullptr, 10);
+            if (!nb_threads)
+                nb_threads = ThreadPool::default_size();
+        }
+        else if (!strncmp(argv[i], "--", 2))
+            usage(argv[0]);
+        else
+            paths.push_back(argv[i]);
+    }
+    if (paths.size() != (merge ? 3 : 2) || (merge && sorted) ||
+        (streaming && layout != CompactLayout::dfs) ||
+        (dawg && (streaming || layout != CompactLayout::dfs)) ||
+        (index_depth && (dawg || streaming)))
+        usage(argv[0]);
+
+    std::cout << "Size structure: " << 4 << std::endl; //FIXME(seirl): wtf
+
+    std::ifstream words_f;
+    if (!merge)
+    {
+        words_f.open(paths[0]);
+        if (!words_f.is_open())
+        {
+            std::cerr << "File not found: " << paths[0] << std::endl;
+            return 1;
+        }
+    }
 
-    std::ofstream dict_f(argv[2]);
+    std::ofstream dict_f(paths.back());
     if (!dict_f.is_open())
     {
-        std::cerr << "File not found: " << argv[2] << std::endl;
+        std::cerr << "File not found: " << paths.back() << std::endl;
         return 1;
     }
 
-    trie->serialize_compact(dict_f);
+    // Calls f(word, freq) for each word, with a freq of 0 for the words
+    // deleted by a merge
+    auto read_words = [&](auto f) {
+        if (merge)
+            return read_merge(paths[0], paths[1], f);
+        return read_lines(words_f, paths[0], [&](const std::string& w,
+                                                 unsigned freq) {
+                f(w, freq);
+                return true;
+        });
+    };
+
+    if (streaming)
+        return compile_streaming(words_f, paths[0], dict_f, sorted,
+                                 memory << 20, read_words);
+
+    std::unique_ptr<RadixTrie> trie;
+    if (!merge)
+    {
+        // Read at once, in a single copy
+        std::string text;
+        words_f.seekg(0, std::ios::end);
+        std::streamoff size = words_f.tellg();
+        words_f.seekg(0, std::ios::beg);
+        if (size > 0)
+        {
+            text.resize(size);
+            words_f.read(&text[0], size);
+            text.resize(words_f.gcount());
+        }
+        else // not a regular file
+        {
+            words_f.clear();
+            text.assign(std::istreambuf_iterator<char>(words_f), {});
+        }
+        std::string error;
+        trie = RadixTrie::load(text, nb_threads, error);
+        if (!trie)
+        {
+            std::cerr << paths[0] << ": " << error << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        trie = std::make_unique<RadixTrie>();
+        if (!read_words([&](const std::string& w, unsigned f) {
+                if (f)
+                    trie->add_word(f, w);
+                else
+                    trie->remove_word(w);
+            }))
+            return 1;
+    }
+    words_f.close();
+
+    bool fits = dawg ? trie->serialize_dawg(dict_f)
+        : trie->serialize_compact(dict_f, layout, index_depth, index_prefix,
+                                  nb_threads);
     dict_f.close();
+    if (!fits)
+    {
+        std::cerr << "Dictionary too big for the 32-bit offsets of the "
+            "compact format" << std::endl;
+        return 1;
+    }
     return 0;
 }
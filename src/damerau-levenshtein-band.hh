@@ -0,0 +1,225 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+#endif
+
+// Kernels computing a row of the table of DamerauLevenshtein, between the
+// columns lb and rb of the band. The cells are 16-bit, saturated at infty.
+//
+// The vector kernels compute the substitutions, deletions and
+// transpositions of a block of cells at once, from the previous rows. The
+// insertions make each cell depend on the one on its left: they are a
+// prefix-min scan, cell[j] = min(cell[j], cell[j - k] + k), done in log2 of
+// the block size shifts, plus the last cell of the previous block. The
+// transpositions compare the word and the word shifted by one (word[-1] is
+// readable) with the last two characters fed.
+//
+// The rows have at least block_size cells of padding after the last column,
+// and the word as many bytes: the last block may read and write past rb.
+struct DamerauLevenshteinBand
+{
+    static constexpr uint16_t infty = 0x7fff;
+    static constexpr unsigned block_size = 16;
+
+    struct row_t
+    {
+        const uint16_t* up2; // row i - 2, if transpose
+        const uint16_t* up;  // row i - 1
+        uint16_t* row;       // row i, whose first cell is set
+        const char* word;
+        char c;              // character i
+        char prev;           // character i - 1, if transpose
+        bool transpose;      // i > 1
+        unsigned lb;
+        unsigned rb;
+        unsigned max_dist;
+    };
+
+    // Returns whether a cell of the band is within max_dist
+    using kernel_t = bool (*)(const row_t&);
+
+    static bool scalar(const row_t& r)
+    {
+        return scalar_(r, r.lb, r.rb);
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    __attribute__((target("sse4.1")))
+    static bool sse41(const row_t& r)
+    {
+        // The first column has no transposition to look at
+        bool cont = r.lb == 0 && r.rb > 0 && scalar_(r, 0, 1);
+        const __m128i inf = _mm_set1_epi16(infty);
+        const __m128i one = _mm_set1_epi16(1);
+        const __m128i lanes = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+        const __m128i c = _mm_set1_epi16(static_cast<unsigned char>(r.c));
+        const __m128i prev =
+            _mm_set1_epi16(static_cast<unsigned char>(r.prev));
+        const __m128i max_dist =
+            _mm_set1_epi16(std::min<unsigned>(r.max_dist, infty - 1));
+        for (unsigned j = std::max(r.lb, 1u); j < r.rb; j += 8)
+        {
+            __m128i up = load128_(r.up + j + 1);
+            __m128i diag = load128_(r.up + j);
+            __m128i w = _mm_cvtepu8_epi16(_mm_loadl_epi64(
+                    reinterpret_cast<const __m128i*>(r.word + j)));
+            __m128i eq = _mm_cmpeq_epi16(w, c);
+            __m128i v = _mm_min_epu16(
+                    _mm_adds_epu16(up, one),
+                    _mm_adds_epu16(diag, _mm_andnot_si128(eq, one)));
+            if (r.transpose)
+            {
+                __m128i w1 = _mm_cvtepu8_epi16(_mm_loadl_epi64(
+                        reinterpret_cast<const __m128i*>(r.word + j - 1)));
+                __m128i t = _mm_and_si128(_mm_cmpeq_epi16(w1, c),
+                                          _mm_cmpeq_epi16(w, prev));
+                __m128i diag2 =
+                    _mm_adds_epu16(load128_(r.up2 + j - 1), one);
+                v = _mm_min_epu16(v, _mm_blendv_epi8(inf, diag2, t));
+            }
+
+            v = _mm_min_epu16(v, _mm_adds_epu16(_mm_alignr_epi8(v, inf, 14),
+                                                one));
+            v = _mm_min_epu16(v, _mm_adds_epu16(_mm_alignr_epi8(v, inf, 12),
+                                                _mm_set1_epi16(2)));
+            v = _mm_min_epu16(v, _mm_adds_epu16(_mm_alignr_epi8(v, inf, 8),
+                                                _mm_set1_epi16(4)));
+            v = _mm_min_epu16(v, _mm_adds_epu16(
+                    _mm_set1_epi16(r.row[j]), _mm_add_epi16(lanes, one)));
+
+            __m128i out =
+                _mm_cmpgt_epi16(lanes, _mm_set1_epi16(r.rb - j - 1));
+            v = _mm_blendv_epi8(_mm_min_epu16(v, inf), inf, out);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(r.row + j + 1), v);
+            cont |= _mm_movemask_epi8(
+                    _mm_cmpeq_epi16(_mm_min_epu16(v, max_dist), v)) != 0;
+        }
+        return cont;
+    }
+
+    __attribute__((target("avx2")))
+    static bool avx2(const row_t& r)
+    {
+        bool cont = r.lb == 0 && r.rb > 0 && scalar_(r, 0, 1);
+        const __m256i inf = _mm256_set1_epi16(infty);
+        const __m256i one = _mm256_set1_epi16(1);
+        const __m256i lanes = _mm256_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7, 8, 9,
+                                                10, 11, 12, 13, 14, 15);
+        const __m256i c = _mm256_set1_epi16(static_cast<unsigned char>(r.c));
+        const __m256i prev =
+            _mm256_set1_epi16(static_cast<unsigned char>(r.prev));
+        const __m256i max_dist =
+            _mm256_set1_epi16(std::min<unsigned>(r.max_dist, infty - 1));
+        for (unsigned j = std::max(r.lb, 1u); j < r.rb; j += 16)
+        {
+            __m256i up = load256_(r.up + j + 1);
+            __m256i diag = load256_(r.up + j);
+            __m256i w = _mm256_cvtepu8_epi16(_mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(r.word + j)));
+            __m256i eq = _mm256_cmpeq_epi16(w, c);
+            __m256i v = _mm256_min_epu16(
+                    _mm256_adds_epu16(up, one),
+                    _mm256_adds_epu16(diag, _mm256_andnot_si256(eq, one)));
+            if (r.transpose)
+            {
+                __m256i w1 = _mm256_cvtepu8_epi16(_mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(r.word + j - 1)));
+                __m256i t = _mm256_and_si256(_mm256_cmpeq_epi16(w1, c),
+                                             _mm256_cmpeq_epi16(w, prev));
+                __m256i diag2 =
+                    _mm256_adds_epu16(load256_(r.up2 + j - 1), one);
+                v = _mm256_min_epu16(v, _mm256_blendv_epi8(inf, diag2, t));
+            }
+
+            v = _mm256_min_epu16(v, _mm256_adds_epu16(shift_<1>(v, inf),
+                                                      one));
+            v = _mm256_min_epu16(v, _mm256_adds_epu16(
+                    shift_<2>(v, inf), _mm256_set1_epi16(2)));
+            v = _mm256_min_epu16(v, _mm256_adds_epu16(
+                    shift_<4>(v, inf), _mm256_set1_epi16(4)));
+            v = _mm256_min_epu16(v, _mm256_adds_epu16(
+                    shift_<8>(v, inf), _mm256_set1_epi16(8)));
+            v = _mm256_min_epu16(v, _mm256_adds_epu16(
+                    _mm256_set1_epi16(r.row[j]),
+                    _mm256_add_epi16(lanes, one)));
+
+            __m256i out =
+                _mm256_cmpgt_epi16(lanes, _mm256_set1_epi16(r.rb - j - 1));
+            v = _mm256_blendv_epi8(_mm256_min_epu16(v, inf), inf, out);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(r.row + j + 1),
+                                v);
+            cont |= _mm256_movemask_epi8(_mm256_cmpeq_epi16(
+                    _mm256_min_epu16(v, max_dist), v)) != 0;
+        }
+        return cont;
+    }
+#endif
+
+    // The fastest kernel supported by the CPU
+    static kernel_t best()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return avx2;
+        if (__builtin_cpu_supports("sse4.1"))
+            return sse41;
+#endif
+        return scalar;
+    }
+
+private:
+    static bool scalar_(const row_t& r, unsigned lb, unsigned rb)
+    {
+        bool cont = false;
+        for (unsigned j = lb; j < rb; j++)
+        {
+            unsigned left = r.row[j];
+            unsigned up = r.up[j + 1];
+            unsigned diag = r.up[j];
+
+            unsigned dist = std::min({
+                    left + 1,
+                    up + 1,
+                    diag + ((r.c == r.word[j]) ? 0 : 1),
+            });
+
+            if (r.transpose && j > 0 &&
+                r.c == r.word[j - 1] && r.prev == r.word[j])
+                dist = std::min<unsigned>(dist, r.up2[j - 1] + 1);
+            dist = std::min<unsigned>(dist, infty);
+            r.row[j + 1] = dist;
+
+            if (dist <= r.max_dist)
+                cont = true;
+        }
+        return cont;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    __attribute__((target("sse4.1")))
+    static __m128i load128_(const uint16_t* p)
+    {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    }
+
+    __attribute__((target("avx2")))
+    static __m256i load256_(const uint16_t* p)
+    {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    }
+
+    // Moves the cells N lanes up, filling the first ones with inf
+    template <int N>
+    __attribute__((target("avx2")))
+    static __m256i shift_(__m256i v, __m256i inf)
+    {
+        __m256i low = _mm256_permute2x128_si256(v, inf, 0x02);
+        return _mm256_alignr_epi8(v, low, 16 - 2 * N);
+    }
+#endif
+};
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "damerau-levenshtein-bitparallel.hh"
+
+// BitParallelDamerauLevenshtein for a group of queries walking the same
+// path: the states of the queries are stored side by side, one array per
+// field, so that feeding a character updates all of them in a single loop
+// without branches. The queries are designated by bit masks, and the
+// states by the length of the path, which makes rolling back free.
+class BatchDamerauLevenshtein
+{
+public:
+    static constexpr size_t max_queries = 16;
+    static constexpr size_t max_word_size =
+        BitParallelDamerauLevenshtein::max_word_size;
+
+    using mask_t = uint32_t;
+
+    BatchDamerauLevenshtein()
+      : n_(0)
+      , max_dist_()
+      , size_()
+      , last_()
+      , cells_()
+      , peq_()
+      , levels_(1)
+    {
+    }
+
+    // Starts again with other words, of at most max_word_size characters;
+    // returns the mask of all the queries
+    mask_t reset(const std::string* const* words, const unsigned* max_dists,
+                 size_t n)
+    {
+        n_ = n;
+        for (auto& row : peq_)
+            row.fill(0);
+        level_t& root = levels_[0];
+        for (size_t q = 0; q < n; q++)
+        {
+            const std::string& word = *words[q];
+            max_dist_[q] = max_dists[q];
+            size_[q] = word.size();
+            last_[q] = size_[q] ? uint64_t(1) << (size_[q] - 1) : 0;
+            cells_[q] = 0;
+            for (size_t j = 0; j < word.size(); j++)
+                peq_[static_cast<unsigned char>(word[j])][q] |=
+                    uint64_t(1) << j;
+            root.vp[q] = size_[q] == 64 ? ~uint64_t(0)
+                                        : (uint64_t(1) << size_[q]) - 1;
+            root.vn[q] = 0;
+            root.d0[q] = 0;
+            root.pm[q] = 0;
+            root.score[q] = size_[q];
+        }
+        return n == max_queries ? ~mask_t(0) >> (32 - max_queries)
+                                : (mask_t(1) << n) - 1;
+    }
+
+    // Feeds c after the len first characters of the path to the queries of
+    // active, returns the ones that can still accept a word
+    mask_t feed(char c, size_t len, mask_t active)
+    {
+        if (levels_.size() < len + 2)
+            levels_.resize(len + 2);
+        const level_t& s = levels_[len];
+        level_t& t = levels_[len + 1];
+        const auto& peq = peq_[static_cast<unsigned char>(c)];
+
+        // Deep in the trie, few queries are still walking: only their
+        // states are computed. Otherwise every query is, even the inactive
+        // ones whose states are not used, in a loop without branches.
+        if (__builtin_popcount(active) * 4 <= n_)
+            for (mask_t m = active; m; m &= m - 1)
+                step_(s, t, peq, __builtin_ctz(m));
+        else
+            for (size_t q = 0; q < n_; q++)
+                step_(s, t, peq, q);
+
+        mask_t res = 0;
+        for (mask_t m = active; m; m &= m - 1)
+        {
+            size_t q = __builtin_ctz(m);
+            cells_[q] += size_[q];
+            if (t.score[q] <= max_dist_[q] || reachable_(t, q, len + 1))
+                res |= mask_t(1) << q;
+        }
+        return res;
+    }
+
+    // The queries of active within their distance of the len first
+    // characters of the path
+    mask_t accepting(size_t len, mask_t active) const
+    {
+        mask_t res = 0;
+        for (mask_t m = active; m; m &= m - 1)
+        {
+            size_t q = __builtin_ctz(m);
+            if (levels_[len].score[q] <= max_dist_[q])
+                res |= mask_t(1) << q;
+        }
+        return res;
+    }
+
+    unsigned dist(size_t len, size_t q) const
+    {
+        return levels_[len].score[q];
+    }
+
+    // Number of cells computed for a query since the last reset
+    uint64_t cells(size_t q) const
+    {
+        return cells_[q];
+    }
+
+private:
+    struct level_t
+    {
+        uint64_t vp[max_queries];
+        uint64_t vn[max_queries];
+        uint64_t d0[max_queries];
+        uint64_t pm[max_queries];
+        unsigned score[max_queries];
+    };
+
+    // Same as BitParallelDamerauLevenshtein::feed() for the query q
+    void step_(const level_t& s, level_t& t,
+               const std::array<uint64_t, max_queries>& peq, size_t q) const
+    {
+        uint64_t pm = peq[q];
+        uint64_t d0 = (((~s.d0[q]) & pm) << 1) & s.pm[q];
+        d0 |= (((pm & s.vp[q]) + s.vp[q]) ^ s.vp[q]) | pm | s.vn[q];
+        uint64_t hp = s.vn[q] | ~(d0 | s.vp[q]);
+        uint64_t hn = d0 & s.vp[q];
+        t.score[q] = s.score[q] + ((hp & last_[q]) != 0) -
+            ((hn & last_[q]) != 0);
+        hp = (hp << 1) | 1;
+        hn = hn << 1;
+        t.vp[q] = hn | ~(d0 | hp);
+        t.vn[q] = hp & d0;
+        t.d0[q] = d0;
+        t.pm[q] = pm;
+    }
+
+    // Same as BitParallelDamerauLevenshtein::reachable_()
+    bool reachable_(const level_t& s, size_t q, size_t i) const
+    {
+        size_t max_dist = max_dist_[q];
+        size_t lb = i > max_dist ? i - max_dist : 1;
+        size_t rb = std::min<size_t>(size_[q], i + max_dist);
+        if (lb > rb)
+            return false;
+
+        uint64_t below = lb == 64 ? ~uint64_t(0) : (uint64_t(1) << lb) - 1;
+        int d = i + __builtin_popcountll(s.vp[q] & below)
+                  - __builtin_popcountll(s.vn[q] & below);
+        for (size_t j = lb; ; j++)
+        {
+            if (d <= static_cast<int>(max_dist))
+                return true;
+            if (j == rb)
+                return false;
+            d += ((s.vp[q] >> j) & 1) - ((s.vn[q] >> j) & 1);
+        }
+    }
+
+    size_t n_;
+    std::array<unsigned, max_queries> max_dist_;
+    std::array<size_t, max_queries> size_;
+    std::array<uint64_t, max_queries> last_;
+    std::array<uint64_t, max_queries> cells_;
+    // positions of each character in the words, by character then query
+    std::array<std::array<uint64_t, max_queries>, 256> peq_;
+    std::vector<level_t> levels_; // by length of the path
+};
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+// Bit-parallel version of DamerauLevenshtein for words of at most 64
+// characters, using Hyyrö's extension of Myers' algorithm to transpositions.
+//
+// Instead of a row of the table, each fed character produces the vertical
+// deltas of the row (D[i][j] - D[i][j - 1], encoded as the +1 and -1 bit
+// vectors vp and vn) in a handful of word operations. The states are kept on
+// a stack indexed by the length of the current word, so rolling back is just
+// popping them.
+class BitParallelDamerauLevenshtein
+{
+public:
+    static const size_t max_word_size = 64;
+
+    const unsigned infty = std::numeric_limits<unsigned>::max() >> 1;
+
+    BitParallelDamerauLevenshtein(const std::string& word = "",
+                                  unsigned max_dist = 0)
+      : max_dist_(0)
+      , size_(0)
+      , last_(0)
+      , peq_()
+      , classes_()
+      , word_classes_(0)
+      , current_()
+      , states_()
+      , cells_(0)
+    {
+        states_.reserve(2 * max_word_size);
+        reset(word, max_dist);
+    }
+
+    // Starts again with another word, keeping the allocated memory
+    void reset(const std::string& word, unsigned max_dist)
+    {
+        max_dist_ = max_dist;
+        size_ = word.size();
+        last_ = size_ ? uint64_t(1) << (size_ - 1) : 0;
+        peq_.fill(0);
+        classes_.fill(0);
+        word_classes_ = 0;
+        for (size_t j = 0; j < size_; j++)
+        {
+            peq_[static_cast<unsigned char>(word[j])] |= uint64_t(1) << j;
+            classes_[word[j] & 31] |= uint64_t(1) << j;
+            word_classes_ |= uint32_t(1) << (word[j] & 31);
+        }
+
+        uint64_t mask = size_ == 64 ? ~uint64_t(0)
+                                    : (uint64_t(1) << size_) - 1;
+        current_.clear();
+        states_.clear();
+        cells_ = 0;
+        states_.push_back(state_t{mask, 0, 0, 0, unsigned(size_), {}});
+    }
+
+    void rollback(unsigned new_len)
+    {
+        current_.resize(new_len);
+        states_.resize(new_len + 1);
+    }
+
+    unsigned dist() const
+    {
+        return states_.back().score;
+    }
+
+    const std::string& current() const
+    {
+        return current_;
+    }
+
+    // Number of cells computed since the last reset, a whole row per feed
+    uint64_t cells() const
+    {
+        return cells_;
+    }
+
+    // Returns a pair (continue searching, accept this one)
+    std::pair<bool, bool> feed(char c)
+    {
+        const state_t& s = states_.back();
+        current_.push_back(c);
+        cells_ += size_;
+
+        uint64_t pm = peq_[static_cast<unsigned char>(c)];
+        uint64_t d0 = (((~s.d0) & pm) << 1) & s.pm; // transpositions
+        d0 |= (((pm & s.vp) + s.vp) ^ s.vp) | pm | s.vn;
+        uint64_t hp = s.vn | ~(d0 | s.vp);
+        uint64_t hn = d0 & s.vp;
+
+        unsigned score = s.score;
+        if (hp & last_)
+            score++;
+        if (hn & last_)
+            score--;
+
+        // The first column is D[i][0] = i, hence the +1 shifted in
+        hp = (hp << 1) | 1;
+        hn = hn << 1;
+        states_.push_back(state_t{hn | ~(d0 | hp), hp & d0, d0, pm, score,
+                                  {}});
+
+        return {score <= max_dist_ || reachable_(), score <= max_dist_};
+    }
+
+    // Whether a word of a subtree can be within the maximum distance, the
+    // rest of it after current() having between min_len and max_len bytes
+    // of the classes of chars (see CompactFormat::CompactHead). The children
+    // of a node share the state, whose bounds are computed once (see
+    // bounds_t).
+    bool reachable(size_t min_len, size_t max_len, uint32_t chars)
+    {
+        state_t& s = states_.back();
+        if (!s.bounds.known)
+            s.bounds = bounds_(s);
+        const bounds_t& b = s.bounds;
+        if (max_len < b.min_rest || min_len > b.max_rest)
+            return false;
+
+        uint64_t tail = ~mask_(b.last + 1);
+        size_t missing = 0;
+        for (uint32_t m = b.tail_classes & ~chars; m; m &= m - 1)
+        {
+            if (!b.slack)
+                return false;
+            missing += __builtin_popcountll(classes_[__builtin_ctz(m)] &
+                                            tail);
+            if (missing > b.slack)
+                return false;
+        }
+        return true;
+    }
+
+private:
+    // What the cells D[i][j] <= max_dist of the last row allow of the rest
+    // of a word. Its distance to word[j..] is at least the difference of
+    // their lengths, and the number of characters of word[j + 1..] of
+    // classes it does not have (word[j] can still be transposed with the
+    // last character fed): these lower bounds are checked against the cells
+    // as a whole, the lengths within [min_rest, max_rest] and the missing
+    // characters after the last cell within the largest slack.
+    struct bounds_t
+    {
+        bool known;
+        unsigned min_rest;
+        unsigned max_rest;
+        unsigned slack; // max_dist - D[i][j], the largest
+        unsigned last; // the last j
+        uint32_t tail_classes; // of word[last + 1..]
+    };
+
+    struct state_t
+    {
+        uint64_t vp;
+        uint64_t vn;
+        uint64_t d0;
+        uint64_t pm;
+        unsigned score; // D[i][size]
+        bounds_t bounds;
+    };
+
+    bounds_t bounds_(const state_t& s) const
+    {
+        bounds_t res{true, 1, 0, 0, 0, 0};
+        size_t i = current_.size();
+        size_t lb = i > max_dist_ ? i - max_dist_ : 0;
+        size_t rb = std::min(size_, i + max_dist_);
+        size_t d = i + __builtin_popcountll(s.vp & mask_(lb))
+                     - __builtin_popcountll(s.vn & mask_(lb));
+        bool first = true;
+        for (size_t j = lb; j <= rb; j++)
+        {
+            if (d <= max_dist_)
+            {
+                unsigned slack = max_dist_ - d;
+                size_t rest = size_ - j;
+                unsigned lo = rest > slack ? rest - slack : 0;
+                unsigned hi = rest + slack;
+                res.min_rest = first ? lo : std::min(res.min_rest, lo);
+                res.max_rest = first ? hi : std::max(res.max_rest, hi);
+                res.slack = std::max(res.slack, slack);
+                res.last = j;
+                first = false;
+            }
+            if (j == rb)
+                break;
+            d += ((s.vp >> j) & 1) - ((s.vn >> j) & 1);
+        }
+        uint64_t tail = ~mask_(res.last + 1);
+        for (uint32_t m = word_classes_; m; m &= m - 1)
+            if (classes_[__builtin_ctz(m)] & tail)
+                res.tail_classes |= m & -m;
+        return res;
+    }
+
+    // Bits below n
+    static uint64_t mask_(size_t n)
+    {
+        return n >= 64 ? ~uint64_t(0) : (uint64_t(1) << n) - 1;
+    }
+
+    // Whether a cell of the last row is within the maximum distance. Only
+    // the diagonal band of size 2 * max_dist + 1 can be.
+    bool reachable_() const
+    {
+        const state_t& s = states_.back();
+        size_t i = current_.size();
+        size_t lb = i > max_dist_ ? i - max_dist_ : 1;
+        size_t rb = std::min(size_, i + max_dist_);
+        if (lb > rb)
+            return false;
+
+        uint64_t below = lb == 64 ? ~uint64_t(0) : (uint64_t(1) << lb) - 1;
+        int d = i + __builtin_popcountll(s.vp & below)
+                  - __builtin_popcountll(s.vn & below);
+        for (size_t j = lb; ; j++)
+        {
+            if (d <= static_cast<int>(max_dist_))
+                return true;
+            if (j == rb)
+                return false;
+            d += ((s.vp >> j) & 1) - ((s.vn >> j) & 1);
+        }
+    }
+
+    unsigned max_dist_;
+    size_t size_;
+    uint64_t last_; // bit of the last character of the word
+    std::array<uint64_t, 256> peq_; // positions of each character in word
+    std::array<uint64_t, 32> classes_; // positions of each class in word
+    uint32_t word_classes_; // bits of the classes of the word
+    std::string current_;
+    std::vector<state_t> states_; // one per character of current_
+    uint64_t cells_;
+};
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+// DamerauLevenshtein for a maximum distance known at compile time. A row
+// only holds the band of 2 * MaxDist + 1 cells around the diagonal, the
+// cell k of the row i being D[i][i + k - MaxDist], so the loops over a row
+// have a constant length and are unrolled. The cells are bytes saturated at
+// infty = MaxDist + 1, since any distance above MaxDist is as good as
+// another.
+//
+// The rows are kept on a stack indexed by the length of the current word,
+// allocated by reset() up to the row ws + MaxDist + 1: its band is entirely
+// after the end of the word, so a search stops there.
+template <unsigned MaxDist>
+class FixedDamerauLevenshtein
+{
+public:
+    static constexpr unsigned width = 2 * MaxDist + 1;
+
+    const unsigned infty = std::numeric_limits<unsigned>::max() >> 1;
+
+    FixedDamerauLevenshtein(const std::string& word = "")
+      : ws_(0)
+      , padded_()
+      , suffix_classes_()
+      , current_()
+      , rows_()
+      , cells_(0)
+    {
+        reset(word);
+    }
+
+    // Starts again with another word, keeping the allocated memory
+    void reset(const std::string& word)
+    {
+        ws_ = word.size();
+        // word[-MaxDist - 2] to word[ws + 2 * MaxDist + 1] are readable
+        padded_.assign(MaxDist + 2, '\0');
+        padded_ += word;
+        padded_.append(2 * MaxDist + 2, '\0');
+        suffix_classes_.assign(ws_ + 2, 0);
+        for (size_t j = ws_; j-- > 0; )
+            suffix_classes_[j] = suffix_classes_[j + 1] |
+                uint32_t(1) << (word[j] & 31);
+        current_.clear();
+        cells_ = 0;
+
+        // rows_[0] stands for the row -1, rows_[i + 1] is the row i
+        if (rows_.size() < ws_ + MaxDist + 3)
+            rows_.resize(ws_ + MaxDist + 3);
+        rows_[0].fill(band_infty);
+        for (unsigned k = 0; k < width; k++)
+            rows_[1][k] = k < MaxDist ? band_infty : k - MaxDist;
+    }
+
+    void rollback(unsigned new_len)
+    {
+        current_.resize(new_len);
+    }
+
+    unsigned dist() const
+    {
+        size_t i = current_.size();
+        size_t k = ws_ + MaxDist - i;
+        if (k >= width)
+            return infty;
+        unsigned res = rows_[i + 1][k];
+        return res >= band_infty ? infty : res;
+    }
+
+    const std::string& current() const
+    {
+        return current_;
+    }
+
+    // Number of cells computed since the last reset
+    uint64_t cells() const
+    {
+        return cells_;
+    }
+
+    // Returns a pair (continue searching, accept this one)
+    std::pair<bool, bool> feed(char c)
+    {
+        current_.push_back(c);
+        size_t i = current_.size();
+        cells_ += width;
+        if (i + 1 == rows_.size())
+            rows_.resize(2 * rows_.size());
+        if (padded_.size() < i + width + 1)
+            padded_.resize(2 * padded_.size(), '\0');
+
+        const row_t& up2 = rows_[i - 1];
+        const row_t& up = rows_[i];
+        row_t& row = rows_[i + 1];
+        // w[k] = word[j - 1], for the column j of the cell k
+        const char* w = padded_.data() + i + 1;
+        char prev = i > 1 ? current_[i - 2] : '\0';
+        long first = long(MaxDist) - long(i); // k of the column 0
+        long last = first + long(ws_); // k of the column ws
+
+        bool cont = false;
+        for (unsigned k = 0; k < width; k++)
+        {
+            unsigned v = up[k] + (w[k] != c);
+            if (k + 1 < width)
+                v = std::min<unsigned>(v, up[k + 1] + 1);
+            if (k > 0)
+                v = std::min<unsigned>(v, row[k - 1] + 1);
+            if (c == w[long(k) - 1] && prev == w[k])
+                v = std::min<unsigned>(v, up2[k] + 1);
+            if (long(k) < first || long(k) > last)
+                v = band_infty;
+            else if (long(k) == first)
+                v = std::min<size_t>(i, band_infty);
+            v = std::min<unsigned>(v, band_infty);
+            row[k] = v;
+            cont |= v <= MaxDist;
+        }
+        return {cont, dist() <= MaxDist};
+    }
+
+    // Whether a word of a subtree can be within MaxDist, the rest of it
+    // after current() having between min_len and max_len bytes of the
+    // classes of chars (see CompactFormat::CompactHead). Same as
+    // BitParallelDamerauLevenshtein::reachable(), the characters of
+    // word[j + 1..] the rest lacks being counted by class.
+    bool reachable(size_t min_len, size_t max_len, uint32_t chars) const
+    {
+        size_t i = current_.size();
+        const row_t& row = rows_[i + 1];
+        bool any = false;
+        unsigned slack = 0;
+        size_t last = 0;
+        for (unsigned k = 0; k < width; k++)
+        {
+            if (row[k] > MaxDist)
+                continue;
+            size_t rest = ws_ + MaxDist - i - k;
+            size_t gap = rest < min_len ? min_len - rest
+                       : rest > max_len ? rest - max_len : 0;
+            any |= row[k] + gap <= MaxDist;
+            slack = std::max<unsigned>(slack, MaxDist - row[k]);
+            last = ws_ - rest;
+        }
+        if (!any)
+            return false;
+        uint32_t absent = suffix_classes_[last + 1] & ~chars;
+        return !absent ||
+            (slack && unsigned(__builtin_popcount(absent)) <= slack);
+    }
+
+private:
+    static constexpr uint8_t band_infty = MaxDist + 1;
+
+    using row_t = std::array<uint8_t, width>;
+
+    size_t ws_;
+    std::string padded_; // the word between two paddings
+    std::vector<uint32_t> suffix_classes_; // of the characters of word[j..]
+    std::string current_;
+    std::vector<row_t> rows_; // by length of current_, see reset()
+    uint64_t cells_;
+};
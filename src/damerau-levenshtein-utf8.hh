@@ -0,0 +1,234 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "utf8.hh"
+
+// BitParallelDamerauLevenshtein on the code points of words of at most 64
+// of them, so that an accented letter is a single edit: "ecole" is at 1 from
+// "école", not 2. The bytes fed are decoded as they come (see Utf8::feed),
+// a row being computed once a character is complete; the states are kept
+// by number of bytes fed, since a character can be split between two edges.
+//
+// The positions of the characters of the word are looked up in a dense
+// alphabet: a table for ASCII, and a short list of the other characters of
+// the word, which are few.
+class Utf8DamerauLevenshtein
+{
+public:
+    static const size_t max_word_size = 64;
+
+    const unsigned infty = std::numeric_limits<unsigned>::max() >> 1;
+
+    Utf8DamerauLevenshtein()
+      : max_dist_(0)
+      , size_(0)
+      , last_(0)
+      , ascii_()
+      , others_()
+      , word_()
+      , current_()
+      , bytes_()
+      , rows_()
+      , cells_(0)
+    {
+        rows_.reserve(2 * max_word_size);
+    }
+
+    // Starts again with another word, of at most max_word_size characters
+    // (see Utf8::size)
+    void reset(const std::string& word, unsigned max_dist)
+    {
+        word_.clear();
+        Utf8::decode(word, word_);
+        max_dist_ = max_dist;
+        size_ = word_.size();
+        last_ = size_ ? uint64_t(1) << (size_ - 1) : 0;
+        ascii_.fill(0);
+        others_.clear();
+        for (size_t j = 0; j < size_; j++)
+        {
+            uint64_t bit = uint64_t(1) << j;
+            if (word_[j] < ascii_.size())
+            {
+                ascii_[word_[j]] |= bit;
+                continue;
+            }
+            size_t k = 0;
+            while (k < others_.size() && others_[k].first != word_[j])
+                k++;
+            if (k == others_.size())
+                others_.emplace_back(word_[j], 0);
+            others_[k].second |= bit;
+        }
+
+        uint64_t mask = size_ == 64 ? ~uint64_t(0)
+                                    : (uint64_t(1) << size_) - 1;
+        current_.clear();
+        bytes_.assign(1, bytes_t{0, 0});
+        rows_.clear();
+        cells_ = 0;
+        rows_.push_back(state_t{mask, 0, 0, 0, unsigned(size_)});
+    }
+
+    void rollback(unsigned new_len)
+    {
+        current_.resize(new_len);
+        bytes_.resize(new_len + 1);
+        rows_.resize(bytes_.back().rows + 1);
+    }
+
+    unsigned dist() const
+    {
+        return rows_.back().score;
+    }
+
+    const std::string& current() const
+    {
+        return current_;
+    }
+
+    // Number of cells computed since the last reset, a whole row per
+    // character
+    uint64_t cells() const
+    {
+        return cells_;
+    }
+
+    // Returns a pair (continue searching, accept this one)
+    std::pair<bool, bool> feed(char c)
+    {
+        current_.push_back(c);
+        bytes_t b = bytes_.back();
+        b.pending = Utf8::feed(current_, b.pending, [this](char32_t symbol) {
+            step_(symbol);
+        });
+        b.rows = rows_.size() - 1;
+        bytes_.push_back(b);
+
+        unsigned score = rows_.back().score;
+        return {score <= max_dist_ || reachable_(),
+                b.pending == 0 && score <= max_dist_};
+    }
+
+    // Same as BitParallelDamerauLevenshtein::reachable() on the lengths
+    // only: the rest of a word has at least a character per 4 bytes. In the
+    // middle of a character, the bytes left of it are not known.
+    bool reachable(size_t min_len, size_t max_len, uint32_t) const
+    {
+        if (bytes_.back().pending)
+            return true;
+        const state_t& s = rows_.back();
+        size_t i = rows_.size() - 1;
+        size_t lb = i > max_dist_ ? i - max_dist_ : 0;
+        size_t rb = std::min(size_, i + max_dist_);
+        if (lb > rb)
+            return false;
+
+        min_len = (min_len + 3) / 4;
+        uint64_t below = lb == 64 ? ~uint64_t(0) : (uint64_t(1) << lb) - 1;
+        size_t d = i + __builtin_popcountll(s.vp & below)
+                     - __builtin_popcountll(s.vn & below);
+        for (size_t j = lb; ; j++)
+        {
+            size_t rest = size_ - j;
+            size_t gap = rest < min_len ? min_len - rest
+                       : rest > max_len ? rest - max_len : 0;
+            if (d + gap <= max_dist_)
+                return true;
+            if (j == rb)
+                return false;
+            d += ((s.vp >> j) & 1) - ((s.vn >> j) & 1);
+        }
+    }
+
+private:
+    struct state_t
+    {
+        uint64_t vp;
+        uint64_t vn;
+        uint64_t d0;
+        uint64_t pm;
+        unsigned score; // D[i][size]
+    };
+
+    // After a number of bytes fed
+    struct bytes_t
+    {
+        size_t rows; // complete characters
+        size_t pending; // bytes of an incomplete character
+    };
+
+    uint64_t peq_(char32_t c) const
+    {
+        if (c < ascii_.size())
+            return ascii_[c];
+        for (const auto& o : others_)
+            if (o.first == c)
+                return o.second;
+        return 0;
+    }
+
+    // Same as BitParallelDamerauLevenshtein::feed() on a character
+    void step_(char32_t c)
+    {
+        const state_t& s = rows_.back();
+        cells_ += size_;
+
+        uint64_t pm = peq_(c);
+        uint64_t d0 = (((~s.d0) & pm) << 1) & s.pm;
+        d0 |= (((pm & s.vp) + s.vp) ^ s.vp) | pm | s.vn;
+        uint64_t hp = s.vn | ~(d0 | s.vp);
+        uint64_t hn = d0 & s.vp;
+
+        unsigned score = s.score;
+        if (hp & last_)
+            score++;
+        if (hn & last_)
+            score--;
+
+        hp = (hp << 1) | 1;
+        hn = hn << 1;
+        rows_.push_back(state_t{hn | ~(d0 | hp), hp & d0, d0, pm, score});
+    }
+
+    // Same as BitParallelDamerauLevenshtein::reachable_()
+    bool reachable_() const
+    {
+        const state_t& s = rows_.back();
+        size_t i = rows_.size() - 1;
+        size_t lb = i > max_dist_ ? i - max_dist_ : 1;
+        size_t rb = std::min(size_, i + max_dist_);
+        if (lb > rb)
+            return false;
+
+        uint64_t below = lb == 64 ? ~uint64_t(0) : (uint64_t(1) << lb) - 1;
+        int d = i + __builtin_popcountll(s.vp & below)
+                  - __builtin_popcountll(s.vn & below);
+        for (size_t j = lb; ; j++)
+        {
+            if (d <= static_cast<int>(max_dist_))
+                return true;
+            if (j == rb)
+                return false;
+            d += ((s.vp >> j) & 1) - ((s.vn >> j) & 1);
+        }
+    }
+
+    unsigned max_dist_;
+    size_t size_;
+    uint64_t last_; // bit of the last character of the word
+    std::array<uint64_t, 128> ascii_; // positions of each character in word
+    std::vector<std::pair<char32_t, uint64_t>> others_;
+    std::vector<char32_t> word_;
+    std::string current_;
+    std::vector<bytes_t> bytes_; // by number of bytes fed
+    std::vector<state_t> rows_; // one per complete character
+    uint64_t cells_;
+};
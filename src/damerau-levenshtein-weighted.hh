@@ -0,0 +1,166 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "edit-costs.hh"
+#include "utf8.hh"
+
+// Damerau-Levenshtein distance whose edits have the costs of a policy (see
+// edit-costs.hh), computed on code points: the bytes fed are decoded as they
+// come, and a row of the table is only computed once a character is
+// complete. The characters are not always on a single edge of the trie: the
+// states are kept by number of bytes fed, so rolling back inside a
+// character works.
+//
+// With non-unit costs, a row can be entirely above max_dist while the row
+// after the next is not, through a transposition cheaper than the edits it
+// replaces. The search thus stops once neither the last row, nor the one
+// before plus the cheapest transposition, is within max_dist: the costs are
+// not negative, so no later row can be below both.
+template <typename Costs>
+class WeightedDamerauLevenshtein
+{
+public:
+    const unsigned infty = std::numeric_limits<unsigned>::max() >> 1;
+
+    WeightedDamerauLevenshtein()
+      : costs_(nullptr)
+      , word_()
+      , ws_(0)
+      , max_dist_(0)
+      , current_()
+      , states_()
+      , path_()
+      , table_()
+      , mins_()
+      , cells_(0)
+    {
+    }
+
+    // Starts again with another word, keeping the allocated memory. The
+    // costs are used until the next reset.
+    void reset(const std::string& word, unsigned max_dist, const Costs& costs)
+    {
+        costs_ = &costs;
+        word_.clear();
+        Utf8::decode(word, word_);
+        ws_ = word_.size();
+        max_dist_ = max_dist;
+        current_.clear();
+        states_.assign(1, state_t{0, 0});
+        path_.clear();
+        cells_ = 0;
+        if (table_.size() < ws_ + 1)
+            table_.resize(ws_ + 1);
+        table_[0] = 0;
+        for (size_t j = 1; j <= ws_; j++)
+            table_[j] = std::min(infty, table_[j - 1] +
+                                 costs.insertion(word_[j - 1]));
+        mins_.assign(1, 0);
+    }
+
+    void rollback(unsigned new_len)
+    {
+        current_.resize(new_len);
+        states_.resize(new_len + 1);
+        path_.resize(states_.back().rows);
+    }
+
+    unsigned dist() const
+    {
+        return table_[path_.size() * (ws_ + 1) + ws_];
+    }
+
+    const std::string& current() const
+    {
+        return current_;
+    }
+
+    // Number of cells computed since the last reset
+    uint64_t cells() const
+    {
+        return cells_;
+    }
+
+    // Returns a pair (continue searching, accept this one)
+    std::pair<bool, bool> feed(char c)
+    {
+        current_.push_back(c);
+        state_t s = states_.back();
+        s.pending = Utf8::feed(current_, s.pending, [this](char32_t symbol) {
+            push_row_(symbol);
+        });
+        s.rows = path_.size();
+        states_.push_back(s);
+
+        size_t i = s.rows;
+        bool cont = mins_[i] <= max_dist_ ||
+            (i > 0 && mins_[i - 1] + costs_->min_transposition() <=
+                      max_dist_);
+        return {cont, s.pending == 0 && dist() <= max_dist_};
+    }
+
+    // The subtrees are not bounded by costs: always true
+    bool reachable(size_t, size_t, uint32_t) const
+    {
+        return true;
+    }
+
+private:
+    // After a number of bytes fed
+    struct state_t
+    {
+        size_t rows; // complete characters
+        size_t pending; // bytes of an incomplete character
+    };
+
+    // Computes the row of the next character of the path
+    void push_row_(char32_t c)
+    {
+        path_.push_back(c);
+        size_t i = path_.size();
+        size_t stride = ws_ + 1;
+        if (table_.size() < (i + 1) * stride)
+            table_.resize(std::max(2 * table_.size(), (i + 1) * stride));
+        if (mins_.size() < i + 1)
+            mins_.resize(i + 1);
+
+        unsigned* row = &table_[i * stride];
+        const unsigned* up = row - stride;
+        unsigned del = costs_->deletion(c);
+        row[0] = std::min(infty, up[0] + del);
+        unsigned min = row[0];
+        for (size_t j = 1; j <= ws_; j++)
+        {
+            char32_t w = word_[j - 1];
+            unsigned dist = std::min({
+                    up[j] + del,
+                    row[j - 1] + costs_->insertion(w),
+                    up[j - 1] + costs_->substitution(c, w),
+            });
+            if (i > 1 && j > 1 && c == word_[j - 2] && path_[i - 2] == w)
+                dist = std::min(dist, up[j - 2 - stride] +
+                                costs_->transposition(path_[i - 2], c));
+            row[j] = std::min(infty, dist);
+            min = std::min(min, row[j]);
+        }
+        mins_[i] = min;
+        cells_ += ws_;
+    }
+
+    const Costs* costs_;
+    std::vector<char32_t> word_;
+    size_t ws_;
+    unsigned max_dist_;
+    std::string current_;
+    std::vector<state_t> states_; // by number of bytes fed
+    std::vector<char32_t> path_; // the complete characters fed
+    std::vector<unsigned> table_; // rows of ws_ + 1 cells
+    std::vector<unsigned> mins_; // of each row
+    uint64_t cells_;
+};
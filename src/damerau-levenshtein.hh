@@ -1,37 +1,67 @@
 #pragma once
 
 #include <algorithm>
+#include <cstdint>
 #include <iomanip>
 #include <iostream>
 #include <limits>
 #include <string>
 #include <vector>
 
+#include "damerau-levenshtein-band.hh"
+
+// The rows of the table are computed by the fastest kernel of
+// DamerauLevenshteinBand, with 16-bit cells: the distances above
+// DamerauLevenshteinBand::infty are all infty.
 class DamerauLevenshtein
 {
 public:
+    using Band = DamerauLevenshteinBand;
+
     const unsigned infty = std::numeric_limits<unsigned>::max() >> 1;
 
-    DamerauLevenshtein(const std::string& word, unsigned max_dist)
-      : word_(word)
-      , max_dist_(max_dist)
+    DamerauLevenshtein(const std::string& word = "", unsigned max_dist = 0,
+                       Band::kernel_t kernel = best_kernel())
+      : word_()
+      , padded_()
+      , ws_(0)
+      , stride_(0)
+      , max_dist_(0)
       , current_()
       , table_(0)
+      , cells_(0)
+      , kernel_(kernel)
     {
-        table_.reserve(word_.size() + 1);
-        for (unsigned j = 0; j < word_.size() + 1; j++)
-            table_.push_back(j);
+        reset(word, max_dist);
+    }
+
+    // Starts again with another word, keeping the allocated memory
+    void reset(const std::string& word, unsigned max_dist)
+    {
+        word_ = word;
+        ws_ = word.size();
+        // word_[-1] and a block past the end are readable by the kernels
+        padded_.assign(1, '\0');
+        padded_ += word;
+        padded_.append(Band::block_size, '\0');
+        stride_ = ws_ + 1 + Band::block_size;
+        max_dist_ = max_dist;
+        current_.clear();
+        table_.assign(stride_, Band::infty);
+        cells_ = 0;
+        for (unsigned j = 0; j < ws_ + 1; j++)
+            table_[j] = std::min<unsigned>(j, Band::infty);
     }
 
     void rollback(unsigned new_len)
     {
         current_.resize(new_len);
-        table_.resize((new_len + 1) * (word_.size() + 1));
     }
 
     unsigned dist() const
     {
-        return table_[table_.size() - 1];
+        unsigned res = table_[current_.size() * stride_ + ws_];
+        return res >= Band::infty ? infty : res;
     }
 
     const std::string& current() const
@@ -39,48 +69,65 @@ public:
         return current_;
     }
 
+    // Number of cells computed since the last reset
+    uint64_t cells() const
+    {
+        return cells_;
+    }
+
     // Returns a pair (continue searching, accept this one)
     std::pair<bool, bool> feed(char c)
     {
-        bool cont = false;
         current_.push_back(c);
-
-        size_t ts = table_.size();
-        size_t ws = word_.size();
         size_t i = current_.size();
+        unsigned lb = lb_(i);
+        unsigned rb = rb_(i);
+        cells_ += rb > lb ? rb - lb : 0;
+
+        // The rows are not cleared: only the cells the next rows read
+        // around the band, and the last one, are set to infty
+        if (table_.size() < (i + 1) * stride_)
+            table_.resize(std::max(2 * table_.size(), (i + 1) * stride_));
+        uint16_t* row = &table_[i * stride_];
+        row[0] = std::min<size_t>(i, Band::infty);
+        size_t end = std::min<size_t>(rb + 2, ws_ + 1);
+        for (size_t j = std::max(lb, 1u); j < end; j++)
+            row[j] = Band::infty;
+        if (ws_)
+            row[ws_] = Band::infty;
+        Band::row_t r{
+            i > 1 ? row - 2 * stride_ : nullptr,
+            row - stride_,
+            row,
+            padded_.data() + 1,
+            c,
+            i > 1 ? current_[i - 2] : '\0',
+            i > 1,
+            lb,
+            rb,
+            max_dist_,
+        };
+        bool cont = kernel_(r);
+        return {cont, dist() <= max_dist_};
+    }
 
-        table_.resize(ts + ws + 1, infty);
-        table_[ts] = i;
-
-        unsigned lb = std::max(0,
-                static_cast<int>(i) - static_cast<int>(max_dist_) - 1);
-        unsigned rb = std::min(word_.size(), i + max_dist_);
-
-        for (unsigned j = lb; j < rb; j++)
+    // Whether a word of a subtree can be within the maximum distance, the
+    // rest of it after current() having between min_len and max_len bytes:
+    // its distance to word[j..] is at least the difference of their lengths
+    bool reachable(size_t min_len, size_t max_len, uint32_t) const
+    {
+        size_t i = current_.size();
+        const uint16_t* row = &table_[i * stride_];
+        size_t end = rb_(i);
+        for (size_t j = i > max_dist_ ? i - max_dist_ : 0; j <= end; j++)
         {
-            unsigned left = table_[i * (ws + 1) + j];
-            unsigned up = table_[(i - 1) * (ws + 1) + j + 1];
-            unsigned diag = table_[(i - 1) * (ws + 1) + j];
-
-            unsigned dist = std::min({
-                    left + 1,
-                    up + 1,
-                    diag + ((c == word_[j]) ? 0 : 1),
-            });
-
-            if (i > 1 && j > 0 &&
-                current_[i - 1] == word_[j - 1] &&
-                current_[i - 2] == word_[j])
-            {
-                unsigned diag2 = table_[(i - 2) * (ws + 1) + j - 1];
-                dist = std::min(dist, diag2 + 1);
-            }
-            table_[i * (ws + 1) + j + 1] = dist;
-
-            if (dist <= max_dist_)
-                cont = true;
+            size_t rest = ws_ - j;
+            size_t gap = rest < min_len ? min_len - rest
+                       : rest > max_len ? rest - max_len : 0;
+            if (row[j] + gap <= max_dist_)
+                return true;
         }
-        return {cont, dist() <= max_dist_};
+        return false;
     }
 
     friend std::ostream& operator<< (std::ostream& out,
@@ -91,28 +138,55 @@ public:
         out << "     ";
         for (auto c: dl.word_)
             out << " " << c << " ";
-        size_t ws = dl.word_.size();
         out << std::endl << " ";
-        for (size_t i = 0; i < dl.table_.size(); i++)
+        for (size_t i = 0; i <= dl.current_.size(); i++)
         {
-            if (i % (ws + 1) == 0 && i / (ws + 1) > 0)
+            if (i > 0)
+                out << std::endl << dl.current_[i - 1];
+            for (size_t j = 0; j <= dl.ws_; j++)
             {
-                out << std::endl;
-                out << dl.current_[i / (ws + 1) - 1];
+                // The cells out of the band are not set
+                unsigned cell = dl.table_[i * dl.stride_ + j];
+                if (i > 0 && j > 0 && (j <= dl.lb_(i) || j > dl.rb_(i)))
+                    cell = Band::infty;
+                out << std::setw(3);
+                if (cell >= Band::infty)
+                    out << "oo";
+                else
+                    out << cell;
             }
-            out << std::setw(3);
-            if (dl.table_[i] > (dl.infty >> 1))
-                out << "oo";
-            else
-                out << dl.table_[i];
         }
         out << std::endl;
         return out;
     }
 
+    // Selected once, on the first use
+    static Band::kernel_t best_kernel()
+    {
+        static const Band::kernel_t kernel = Band::best();
+        return kernel;
+    }
+
 private:
+    // Band of the row i: the cells lb + 1 to rb are computed
+    unsigned lb_(size_t i) const
+    {
+        return std::max(0, static_cast<int>(i) -
+                           static_cast<int>(max_dist_) - 1);
+    }
+
+    unsigned rb_(size_t i) const
+    {
+        return std::min(ws_, i + max_dist_);
+    }
+
     std::string word_;
+    std::string padded_; // word_ between a leading and trailing padding
+    size_t ws_;
+    size_t stride_; // of the rows of table_, padding included
     unsigned max_dist_;
     std::string current_;
-    std::vector<unsigned> table_;
+    std::vector<uint16_t> table_;
+    uint64_t cells_;
+    Band::kernel_t kernel_;
 };
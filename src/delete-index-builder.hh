@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "delete-index.hh"
+
+// Builds the DeleteIndex section of the words given to add()
+class DeleteIndexBuilder
+{
+public:
+    DeleteIndexBuilder(unsigned depth, size_t prefix = 0)
+      : depth_(depth)
+      , prefix_(prefix)
+      , nb_words_(0)
+      , records_()
+      , entries_()
+      , hashes_()
+      , buf_()
+    {
+    }
+
+    void add(const std::string& word, unsigned freq)
+    {
+        assert(records_.size() / 4 <= UINT32_MAX);
+        uint32_t id = records_.size() / 4;
+        append_(records_, uint32_t(freq));
+        append_(records_, uint32_t(word.size()));
+        records_ += word;
+        records_.append(padding_(records_.size(), 4), '\0');
+        nb_words_++;
+
+        hashes_.clear();
+        DeleteIndex::for_each_variant(word, prefix_, depth_, buf_,
+                [this](const std::string& v) {
+                    hashes_.push_back(DeleteIndex::hash(v.data(), v.size()));
+                });
+        std::sort(hashes_.begin(), hashes_.end());
+        hashes_.erase(std::unique(hashes_.begin(), hashes_.end()),
+                      hashes_.end());
+        for (auto h : hashes_)
+            entries_.push_back({h, id});
+    }
+
+    // Returns the section, to be written at an offset aligned on
+    // DeleteIndex::alignment
+    std::string finish()
+    {
+        std::sort(entries_.begin(), entries_.end());
+        assert(entries_.size() <= UINT32_MAX);
+
+        // About two entries per bucket
+        uint32_t bits = 1;
+        while (bits < 32 && (uint64_t(1) << bits) < entries_.size() / 2)
+            bits++;
+        uint32_t nb_buckets = uint32_t(1) << bits;
+
+        std::string res;
+        size_t header = offsetof(DeleteIndex, buckets) +
+            (nb_buckets + 1) * sizeof (uint32_t);
+        uint64_t entries = header + padding_(header, DeleteIndex::alignment);
+        uint64_t words = entries +
+            entries_.size() * sizeof (DeleteIndex::entry_t);
+
+        append_(res, depth_);
+        append_(res, uint32_t(prefix_));
+        append_(res, bits);
+        append_(res, nb_words_);
+        append_(res, entries);
+        append_(res, words);
+        size_t e = 0;
+        for (uint64_t b = 0; b <= nb_buckets; b++)
+        {
+            while (e < entries_.size() && entries_[e].first >> (64 - bits) < b)
+                e++;
+            append_(res, uint32_t(e));
+        }
+        res.append(padding_(res.size(), DeleteIndex::alignment), '\0');
+        for (const auto& entry : entries_)
+            append_(res, DeleteIndex::entry_t{uint32_t(entry.first),
+                                              entry.second});
+        res += records_;
+        res.append(padding_(res.size(), DeleteIndex::alignment), '\0');
+        return res;
+    }
+
+private:
+    template <typename T>
+    static void append_(std::string& out, const T& value)
+    {
+        out.append(reinterpret_cast<const char*>(&value), sizeof (T));
+    }
+
+    static size_t padding_(size_t pos, size_t alignment)
+    {
+        return (alignment - pos % alignment) % alignment;
+    }
+
+    uint32_t depth_;
+    size_t prefix_;
+    uint32_t nb_words_;
+    std::string records_;
+    std::vector<std::pair<uint64_t, uint32_t>> entries_; // hash, word
+    std::vector<uint64_t> hashes_; // of the variants of the current word
+    std::string buf_;
+};
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Optional section of a CompactFormat file, after the trie: a hash index of
+// the deletion variants of the words (symmetric delete). Two words within
+// distance d of each other have a common variant obtained by deleting at most
+// d characters from each, so the candidates of a query are the words sharing
+// one of its variants; they are then verified with the distance automaton.
+//
+// Only the variants of the first prefix characters of a word are indexed,
+// when prefix is not 0, which bounds the size of the index but gives more
+// candidates. Variants are stored as the bucket (top bits) and the low 32 bits
+// of their 64 bits hash, so a collision only adds a candidate.
+struct DeleteIndex
+{
+    static const size_t alignment = 8;
+
+    uint32_t depth;    // maximum number of deletions
+    uint32_t prefix;   // 0 for the whole words
+    uint32_t bits;     // log2 of the number of buckets
+    uint32_t nb_words;
+    uint64_t entries;  // offset of the entry_t, sorted by hash
+    uint64_t words;    // offset of the word records
+    uint32_t buckets[1]; // index of the first entry of each bucket, and end
+    // entry_t entries[buckets[1 << bits]];
+    // word records: uint32_t freq, uint32_t len, char word[len], padding,
+    // copies of the words of the trie (see CompactFormat)
+
+    struct entry_t
+    {
+        uint32_t hash;
+        uint32_t word; // offset of the word record / 4
+    };
+
+    // Returns the index of a file, nullptr if it has none
+    static const DeleteIndex* get(const char* start, uint32_t offset)
+    {
+        if (!offset)
+            return nullptr;
+        return reinterpret_cast<const DeleteIndex*>(start + offset);
+    }
+
+    static uint64_t hash(const char* s, size_t len)
+    {
+        // FNV-1a
+        uint64_t h = 14695981039346656037ULL;
+        for (size_t i = 0; i < len; i++)
+        {
+            h ^= static_cast<unsigned char>(s[i]);
+            h *= 1099511628211ULL;
+        }
+        return h ^ (h >> 29);
+    }
+
+    // Calls f(variant) for the variants of word with at most depth deletions,
+    // including the word itself. buf is used as scratch memory. A variant can
+    // be given several times when the word has repeated characters.
+    template <typename Fn>
+    static void for_each_variant(const std::string& word, size_t prefix,
+                                 unsigned depth, std::string& buf, Fn f)
+    {
+        buf.assign(word, 0, prefix ? prefix : std::string::npos);
+        f(buf);
+        variants_(buf, 0, depth, f);
+    }
+
+    // Adds the words having a variant of this hash to candidates
+    void probe(uint64_t h, std::vector<uint32_t>& candidates) const
+    {
+        uint32_t b = h >> (64 - bits);
+        const entry_t* e = entries_();
+        for (uint32_t i = buckets[b]; i < buckets[b + 1]; i++)
+            if (e[i].hash == uint32_t(h))
+                candidates.push_back(e[i].word);
+    }
+
+    unsigned freq(uint32_t word) const
+    {
+        return record_(word)[0];
+    }
+
+    size_t len(uint32_t word) const
+    {
+        return record_(word)[1];
+    }
+
+    const char* word(uint32_t word) const
+    {
+        return reinterpret_cast<const char*>(record_(word) + 2);
+    }
+
+private:
+    template <typename Fn>
+    static void variants_(std::string& buf, size_t from, unsigned depth,
+                          Fn& f)
+    {
+        if (!depth)
+            return;
+        // Deleting the positions in increasing order lists each set once
+        for (size_t i = from; i < buf.size(); i++)
+        {
+            char c = buf[i];
+            buf.erase(i, 1);
+            f(buf);
+            variants_(buf, i, depth - 1, f);
+            buf.insert(buf.begin() + i, c);
+        }
+    }
+
+    const char* base_() const
+    {
+        return reinterpret_cast<const char*>(this);
+    }
+
+    const entry_t* entries_() const
+    {
+        return reinterpret_cast<const entry_t*>(base_() + entries);
+    }
+
+    const uint32_t* record_(uint32_t word) const
+    {
+        return reinterpret_cast<const uint32_t*>(base_() + words +
+                                                 uint64_t(word) * 4);
+    }
+};
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "radix-trie.hh"
+
+// Words added or deleted since the dictionary was compiled. The searches of
+// CompactRadixTrie given an overlay walk both the dictionary and the tries of
+// the overlay, feeding the same collector: the words of the overlay replace
+// the ones of the dictionary, and a word deleted is a tombstone, hiding the
+// word of the dictionary.
+//
+// The changes are kept in immutable segments shared between the copies of an
+// overlay, so that a copy only copies pointers. Each change is a new segment,
+// merged with the previous ones while they hold no more changes (as the
+// carries of a binary counter): there are O(log n) segments, a change being
+// merged O(log n) times. The segments are ordered from the oldest, the
+// entries of a segment replacing the ones of the older segments.
+class DictionaryOverlay
+{
+public:
+    using format_t = RadixTrieFormat;
+
+    DictionaryOverlay()
+      : segments_()
+      , version_(next_version_())
+    {
+    }
+
+    DictionaryOverlay(const DictionaryOverlay& other)
+      : segments_(other.segments_)
+      , version_(next_version_())
+    {
+    }
+
+    DictionaryOverlay& operator=(const DictionaryOverlay&) = delete;
+
+    // Adds word, or replaces its frequency. A frequency of 0 deletes it.
+    void add(const std::string& word, unsigned freq)
+    {
+        auto seg = std::make_shared<segment_t>();
+        seg->entries[word] = freq;
+        seg->commands = 1;
+        while (!segments_.empty() &&
+               segments_.back()->commands <= seg->commands)
+        {
+            // The newer entries win
+            seg->entries.insert(segments_.back()->entries.begin(),
+                                segments_.back()->entries.end());
+            seg->commands += segments_.back()->commands;
+            segments_.pop_back();
+        }
+        for (const auto& e : seg->entries)
+            if (e.second)
+                seg->trie.add_word(e.second, e.first);
+        segments_.push_back(std::move(seg));
+        version_ = next_version_();
+    }
+
+    // Increases with every change of every overlay
+    uint64_t version() const
+    {
+        return version_;
+    }
+
+    bool empty() const
+    {
+        return segments_.empty();
+    }
+
+    // Whether word was added or deleted; freq is set to 0 if it was deleted
+    bool find(const std::string& word, unsigned& freq) const
+    {
+        for (size_t s = segments_.size(); s-- > 0; )
+        {
+            const auto& entries = segments_[s]->entries;
+            auto it = entries.find(word);
+            if (it != entries.end())
+            {
+                freq = it->second;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t nb_segments() const
+    {
+        return segments_.size();
+    }
+
+    // The trie of the words of a segment, some of which may be replaced by
+    // newer segments (see shadowed())
+    format_t::node_t root(size_t segment) const
+    {
+        return &segments_[segment]->trie;
+    }
+
+    // Whether a segment newer than segment has an entry for word
+    bool shadowed(size_t segment, const std::string& word) const
+    {
+        for (size_t s = segment + 1; s < segments_.size(); s++)
+            if (segments_[s]->entries.count(word))
+                return true;
+        return false;
+    }
+
+    // Calls f(word, freq) for each command of a log, with a freq of 0 for
+    // the deletions. Returns false on a malformed line.
+    template <typename Fn>
+    static bool read_log(std::istream& in, Fn f)
+    {
+        std::string line;
+        while (std::getline(in, line))
+        {
+            std::istringstream cmd(line);
+            std::string name;
+            std::string word;
+            unsigned freq = 0;
+            if (!(cmd >> name))
+                continue;
+            if ((name != "add" && name != "del") || !(cmd >> word) ||
+                (name == "add" && !(cmd >> freq)))
+                return false;
+            f(word, freq);
+        }
+        return true;
+    }
+
+private:
+    static uint64_t next_version_()
+    {
+        static std::atomic<uint64_t> next{0};
+        return next++;
+    }
+
+    struct segment_t
+    {
+        RadixTrie trie; // of the words with a frequency
+        std::unordered_map<std::string, unsigned> entries; // 0 if deleted
+        size_t commands; // merged in the segment
+    };
+
+    std::vector<std::shared_ptr<const segment_t>> segments_; // oldest first
+    uint64_t version_;
+};
+
+// Applies the add and del commands of the app in the order they are read.
+// They change a private copy of the overlay, which snapshot() publishes to
+// the queries read after them: a copy is only made for the first command
+// following a snapshot, and only copies the pointers to its segments. The
+// commands can also be appended to a log, which TextMiningCompiler --merge
+// folds into the dictionary.
+class OverlayWriter
+{
+public:
+    OverlayWriter()
+      : current_(std::make_shared<DictionaryOverlay>())
+      , published_(false)
+      , log_()
+    {
+    }
+
+    // Replays the commands of the log if it exists, and appends the next
+    // ones to it. Returns false and sets error if it can't be used.
+    bool open_log(const std::string& path, std::string& error)
+    {
+        std::ifstream in(path);
+        if (in.is_open() &&
+            !DictionaryOverlay::read_log(in, [this](const std::string& w,
+                                                    unsigned f) {
+                    own_();
+                    current_->add(w, f);
+            }))
+        {
+            error = "Malformed log: " + path;
+            return false;
+        }
+        log_.open(path, std::ios::app);
+        if (!log_.is_open())
+        {
+            error = "Could not open " + path;
+            return false;
+        }
+        return true;
+    }
+
+    void add(const std::string& word, unsigned freq)
+    {
+        own_();
+        current_->add(word, freq);
+        if (log_.is_open())
+        {
+            if (freq)
+                log_ << "add " << word << ' ' << freq << std::endl;
+            else
+                log_ << "del " << word << std::endl;
+        }
+    }
+
+    std::shared_ptr<const DictionaryOverlay> snapshot()
+    {
+        published_ = true;
+        return current_;
+    }
+
+private:
+    void own_()
+    {
+        if (!published_)
+            return;
+        current_ = std::make_shared<DictionaryOverlay>(*current_);
+        published_ = false;
+    }
+
+    std::shared_ptr<DictionaryOverlay> current_;
+    bool published_; // current_ may be used by queries
+    std::ofstream log_;
+};
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "dictionary.hh"
+
+// Holds the current dictionary and replaces it when its file changes, or
+// when reload() is called. A new file is mapped, preloaded and checked by a
+// background thread, then published atomically: the queries started after
+// that use it, while the ones holding the previous dictionary keep it mapped
+// until they are done.
+//
+// Files should be replaced by a rename: a file written in place changes
+// under the feet of the queries running on it.
+class DictionaryWatcher
+{
+public:
+    DictionaryWatcher(const std::string& path,
+                      std::shared_ptr<const Dictionary> dict, bool watch)
+      : path_(path)
+      , name_()
+      , current_(std::move(dict))
+      , generation_(0)
+      , inotify_(-1)
+      , wakeup_(eventfd(0, EFD_CLOEXEC))
+      , stop_(false)
+      , thread_()
+    {
+        if (watch)
+            watch_();
+        thread_ = std::thread([this]() { run_(); });
+    }
+
+    ~DictionaryWatcher()
+    {
+        stop_ = true;
+        wake_();
+        thread_.join();
+        if (inotify_ != -1)
+            close(inotify_);
+        close(wakeup_);
+    }
+
+    DictionaryWatcher(const DictionaryWatcher&) = delete;
+    DictionaryWatcher& operator=(const DictionaryWatcher&) = delete;
+
+    std::shared_ptr<const Dictionary> current() const
+    {
+        return std::atomic_load(&current_);
+    }
+
+    // Number of dictionaries published since the first one
+    unsigned generation() const
+    {
+        return generation_;
+    }
+
+    // Asks the thread to map the file again
+    void reload()
+    {
+        wake_();
+    }
+
+private:
+    void watch_()
+    {
+        // The directory is watched, to see the file being replaced
+        size_t slash = path_.rfind('/');
+        std::string dir = slash == std::string::npos ? "."
+            : path_.substr(0, std::max<size_t>(slash, 1));
+        name_ = slash == std::string::npos ? path_ : path_.substr(slash + 1);
+        inotify_ = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+        if (inotify_ == -1 ||
+            inotify_add_watch(inotify_, dir.c_str(),
+                              IN_CLOSE_WRITE | IN_MOVED_TO) == -1)
+            std::cerr << "Could not watch " << path_ << ": " <<
+                strerror(errno) << std::endl;
+    }
+
+    void wake_()
+    {
+        uint64_t one = 1;
+        if (write(wakeup_, &one, sizeof (one)) < 0)
+            return; // the counter is already set
+    }
+
+    // Whether the pending inotify events are about the file
+    bool changed_()
+    {
+        alignas(inotify_event) char buf[4096];
+        bool res = false;
+        ssize_t len;
+        while ((len = read(inotify_, buf, sizeof (buf))) > 0)
+            for (ssize_t i = 0; i < len; )
+            {
+                const auto* ev =
+                    reinterpret_cast<const inotify_event*>(buf + i);
+                if (ev->len && name_ == ev->name)
+                    res = true;
+                i += sizeof (inotify_event) + ev->len;
+            }
+        return res;
+    }
+
+    void run_()
+    {
+        pollfd fds[2] = {
+            { wakeup_, POLLIN, 0 },
+            { inotify_, POLLIN, 0 },
+        };
+        while (!stop_)
+        {
+            if (poll(fds, inotify_ == -1 ? 1 : 2, -1) < 0)
+                continue;
+            bool load = false;
+            if (fds[0].revents & POLLIN)
+            {
+                uint64_t count;
+                if (read(wakeup_, &count, sizeof (count)) > 0)
+                    load = !stop_;
+            }
+            if (inotify_ != -1 && (fds[1].revents & POLLIN) && changed_())
+                load = true;
+            if (load && !stop_)
+                load_();
+        }
+    }
+
+    void load_()
+    {
+        // Preloaded, so checked entirely before it replaces the current one
+        std::string error;
+        auto dict = Dictionary::open(path_, error, true);
+        if (!dict)
+        {
+            std::cerr << error << ", keeping the current dictionary" <<
+                std::endl;
+            return;
+        }
+        std::atomic_store(&current_, std::move(dict));
+        generation_++;
+    }
+
+    std::string path_;
+    std::string name_; // in its directory
+    std::shared_ptr<const Dictionary> current_;
+    std::atomic<unsigned> generation_;
+    int inotify_;
+    int wakeup_;
+    std::atomic<bool> stop_;
+    std::thread thread_;
+};
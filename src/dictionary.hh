@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "compact-radix-trie.hh"
+
+// A compiled dictionary mapped in memory, unmapped by the destructor. The
+// queries hold a shared_ptr to the dictionary they run on, so a dictionary
+// replaced by a newer one stays mapped until they are done.
+class Dictionary
+{
+public:
+    // Returns nullptr and sets error if the file can't be used. A preloaded
+    // dictionary is read entirely, which faults its pages in and checks its
+    // checksum, so that the first queries on it don't wait for the disk.
+    static std::shared_ptr<const Dictionary> open(const std::string& path,
+                                                  std::string& error,
+                                                  bool preload = false)
+    {
+        int fd = -1;
+        if ((fd = ::open(path.c_str(), O_RDONLY)) == -1)
+        {
+            error = "Could not open " + path;
+            return nullptr;
+        }
+
+        struct stat s;
+        if (fstat(fd, &s) < 0 || s.st_size == 0)
+        {
+            error = "Could not read " + path;
+            close(fd);
+            return nullptr;
+        }
+
+        int flags = MAP_FILE | MAP_SHARED | (preload ? MAP_POPULATE : 0);
+        void* file = mmap(NULL, s.st_size, PROT_READ, flags, fd, 0);
+        close(fd);
+        if (file == MAP_FAILED)
+        {
+            error = "Could not map " + path;
+            return nullptr;
+        }
+
+        std::shared_ptr<const Dictionary> res(
+                new Dictionary(reinterpret_cast<const char*>(file),
+                               s.st_size));
+        if (!CompactRadixTrie::version(res->start(), res->size()))
+        {
+            error = "Invalid or unsupported dictionary: " + path;
+            return nullptr;
+        }
+        if (preload)
+        {
+            madvise(file, s.st_size, MADV_WILLNEED);
+            if (!CompactRadixTrie::verify(res->start(), res->size()))
+            {
+                error = "Corrupted dictionary: " + path;
+                return nullptr;
+            }
+        }
+        return res;
+    }
+
+    ~Dictionary()
+    {
+        munmap(const_cast<char*>(start_), size_);
+    }
+
+    Dictionary(const Dictionary&) = delete;
+    Dictionary& operator=(const Dictionary&) = delete;
+
+    const char* start() const
+    {
+        return start_;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    // Increases with the dictionaries opened, which tells the answers
+    // cached for a replaced dictionary apart
+    uint64_t id() const
+    {
+        return id_;
+    }
+
+private:
+    Dictionary(const char* start, size_t size)
+      : start_(start)
+      , size_(size)
+      , id_(next_id_())
+    {
+    }
+
+    static uint64_t next_id_()
+    {
+        static std::atomic<uint64_t> next{0};
+        return next++;
+    }
+
+    const char* start_;
+    size_t size_;
+    uint64_t id_;
+};
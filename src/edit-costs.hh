@@ -0,0 +1,340 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "tokenizer.hh"
+#include "utf8.hh"
+
+// Costs of the edits of WeightedDamerauLevenshtein, by code point: the
+// characters of the word of the dictionary are deleted or substituted, the
+// ones of the query inserted. The costs are integers, in units of one edit
+// divided by unit.
+//
+// UnitCosts gives the plain Damerau-Levenshtein distance.
+struct UnitCosts
+{
+    static constexpr unsigned unit = 1;
+
+    unsigned insertion(char32_t) const
+    {
+        return 1;
+    }
+
+    unsigned deletion(char32_t) const
+    {
+        return 1;
+    }
+
+    unsigned substitution(char32_t a, char32_t b) const
+    {
+        return a != b;
+    }
+
+    unsigned transposition(char32_t, char32_t) const
+    {
+        return 1;
+    }
+
+    // Lower bound of transposition()
+    unsigned min_transposition() const
+    {
+        return 1;
+    }
+};
+
+// Costs read from a text file, in tenths of an edit. Each line is a rule,
+// the later ones overriding the earlier ones; # starts a comment:
+//
+//   insertion COST           every insertion, by default 1
+//   insertion C COST         the insertion of the character C
+//   deletion COST            the same for the deletions
+//   deletion C COST
+//   substitution COST        every substitution, by default 1
+//   substitution A B COST    A by B and B by A
+//   transposition COST       every transposition, by default 1
+//   keyboard LAYOUT COST     the substitutions of the keys next to each
+//                            other on an azerty or qwerty keyboard
+//   accents COST             the substitutions of the letters that only
+//                            differ by their accent (é, è, e, ...)
+//
+// A cost is a decimal number with at most one digit after the point, within
+// 25: "substitution é e 0.1".
+class EditCostTable
+{
+public:
+    static constexpr unsigned unit = 10;
+    static constexpr unsigned max_cost = 250;
+
+    EditCostTable()
+      : insertion_(unit)
+      , deletion_(unit)
+      , substitution_(unit)
+      , transposition_(unit)
+      , char_insertion_()
+      , char_deletion_()
+      , latin1_()
+      , pairs_()
+    {
+        memset(char_insertion_, unset, sizeof (char_insertion_));
+        memset(char_deletion_, unset, sizeof (char_deletion_));
+        memset(latin1_, unset, sizeof (latin1_));
+    }
+
+    // Reads the rules of a file, returns nullptr with an error if it can't
+    static std::unique_ptr<EditCostTable> open(const std::string& path,
+                                               std::string& error)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            error = "Could not open " + path;
+            return nullptr;
+        }
+        std::ostringstream text;
+        text << file.rdbuf();
+        auto res = load(text.str(), error);
+        if (!res)
+            error += " in " + path;
+        return res;
+    }
+
+    static std::unique_ptr<EditCostTable> load(std::string_view text,
+                                               std::string& error)
+    {
+        auto res = std::make_unique<EditCostTable>();
+        size_t begin = 0;
+        while (begin < text.size())
+        {
+            size_t end = text.find('\n', begin);
+            if (end == std::string_view::npos)
+                end = text.size();
+            std::string_view line = text.substr(begin, end - begin);
+            begin = end + 1;
+            line = line.substr(0, line.find('#'));
+            if (!res->apply_(line))
+            {
+                error = "Malformed rule: " + std::string(line);
+                return nullptr;
+            }
+        }
+        return res;
+    }
+
+    unsigned insertion(char32_t c) const
+    {
+        return char_cost_(char_insertion_, c, 'i', insertion_);
+    }
+
+    unsigned deletion(char32_t c) const
+    {
+        return char_cost_(char_deletion_, c, 'd', deletion_);
+    }
+
+    unsigned substitution(char32_t a, char32_t b) const
+    {
+        if (a == b)
+            return 0;
+        if (a < 256 && b < 256)
+        {
+            uint8_t res = latin1_[a][b];
+            return res != unset ? res : substitution_;
+        }
+        auto it = pairs_.find(key_('s', a, b));
+        return it != pairs_.end() ? it->second : substitution_;
+    }
+
+    unsigned transposition(char32_t, char32_t) const
+    {
+        return transposition_;
+    }
+
+    unsigned min_transposition() const
+    {
+        return transposition_;
+    }
+
+private:
+    static const uint8_t unset = 0xff;
+
+    // Rows of the letter keys, each shifted by half a key to the right of
+    // the one above
+    static const char* const* layout_(std::string_view name)
+    {
+        static const char* const azerty[] = {
+            "azertyuiop", "qsdfghjklm", "wxcvbn", nullptr,
+        };
+        static const char* const qwerty[] = {
+            "qwertyuiop", "asdfghjkl", "zxcvbnm", nullptr,
+        };
+        return name == "azerty" ? azerty : name == "qwerty" ? qwerty
+                                                             : nullptr;
+    }
+
+    // Letter of c without its accent, c itself if it has none
+    static char32_t fold_(char32_t c)
+    {
+        // From U+00C0 to U+00FF, ? for the ones that are not accented
+        static const char folded[] =
+            "AAAAAA?CEEEEIIII?NOOOOO?OUUUUY??aaaaaa?ceeeeiiii?nooooo?ouuuuy?y";
+        if (c < 0xc0 || c > 0xff || folded[c - 0xc0] == '?')
+            return c;
+        return folded[c - 0xc0];
+    }
+
+    static uint64_t key_(char kind, char32_t a, char32_t b)
+    {
+        return (uint64_t(kind) << 56) | (uint64_t(a) << 28) | b;
+    }
+
+    unsigned char_cost_(const uint8_t* costs, char32_t c, char kind,
+                        unsigned fallback) const
+    {
+        if (c < 256)
+            return costs[c] != unset ? costs[c] : fallback;
+        auto it = pairs_.find(key_(kind, c, 0));
+        return it != pairs_.end() ? it->second : fallback;
+    }
+
+    static bool parse_cost_(std::string_view token, unsigned& cost)
+    {
+        size_t dot = token.find('.');
+        unsigned units = 0;
+        unsigned tenths = 0;
+        if (!parse_number(token.substr(0, dot), units) ||
+            (dot != std::string_view::npos &&
+             (token.size() != dot + 2 ||
+              !parse_number(token.substr(dot + 1), tenths))))
+            return false;
+        cost = units * unit + tenths;
+        return units <= max_cost / unit && cost <= max_cost;
+    }
+
+    // The code point of a token of a single character
+    static bool parse_char_(std::string_view token, char32_t& c)
+    {
+        size_t len = token.empty() ? 0 : Utf8::length(token[0]);
+        if (!len || len != token.size())
+            return false;
+        for (size_t i = 1; i < len; i++)
+            if (!Utf8::continuation(token[i]))
+                return false;
+        c = Utf8::decode(token.data(), len);
+        return true;
+    }
+
+    void set_char_(uint8_t* costs, char kind, char32_t c, unsigned cost)
+    {
+        if (c < 256)
+            costs[c] = cost;
+        else
+            pairs_[key_(kind, c, 0)] = cost;
+    }
+
+    void set_substitution_(char32_t a, char32_t b, unsigned cost)
+    {
+        if (a < 256 && b < 256)
+        {
+            latin1_[a][b] = cost;
+            latin1_[b][a] = cost;
+            return;
+        }
+        pairs_[key_('s', a, b)] = cost;
+        pairs_[key_('s', b, a)] = cost;
+    }
+
+    void set_keyboard_(const char* const* rows, unsigned cost)
+    {
+        auto set = [&](char a, char b) {
+            set_substitution_(a, b, cost);
+            set_substitution_(a - 'a' + 'A', b - 'a' + 'A', cost);
+        };
+        for (size_t r = 0; rows[r]; r++)
+            for (size_t c = 0; rows[r][c]; c++)
+            {
+                // The keys on the right and the two keys below
+                if (rows[r][c + 1])
+                    set(rows[r][c], rows[r][c + 1]);
+                if (!rows[r + 1])
+                    continue;
+                size_t below = strlen(rows[r + 1]);
+                if (c < below)
+                    set(rows[r][c], rows[r + 1][c]);
+                if (c > 0 && c - 1 < below)
+                    set(rows[r][c], rows[r + 1][c - 1]);
+            }
+    }
+
+    void set_accents_(unsigned cost)
+    {
+        for (char32_t a = 'A'; a < 256; a++)
+            for (char32_t b = 'A'; b < a; b++)
+                if (fold_(a) == fold_(b))
+                    set_substitution_(a, b, cost);
+    }
+
+    bool apply_(std::string_view line)
+    {
+        size_t pos = 0;
+        std::string_view tokens[4];
+        size_t n = 0;
+        for (std::string_view t = next_token(line, pos); !t.empty();
+             t = next_token(line, pos))
+        {
+            if (n == 4)
+                return false;
+            tokens[n++] = t;
+        }
+        if (n == 0)
+            return true;
+
+        unsigned cost;
+        char32_t a;
+        char32_t b;
+        if (!parse_cost_(tokens[n - 1], cost))
+            return false;
+        std::string_view rule = tokens[0];
+        if (n == 2 && rule == "insertion")
+            insertion_ = cost;
+        else if (n == 2 && rule == "deletion")
+            deletion_ = cost;
+        else if (n == 2 && rule == "substitution")
+            substitution_ = cost;
+        else if (n == 2 && rule == "transposition")
+            transposition_ = cost;
+        else if (n == 2 && rule == "accents")
+            set_accents_(cost);
+        else if (n == 3 && rule == "keyboard" && layout_(tokens[1]))
+            set_keyboard_(layout_(tokens[1]), cost);
+        else if (n == 3 && rule == "insertion" && parse_char_(tokens[1], a))
+            set_char_(char_insertion_, 'i', a, cost);
+        else if (n == 3 && rule == "deletion" && parse_char_(tokens[1], a))
+            set_char_(char_deletion_, 'd', a, cost);
+        else if (n == 4 && rule == "substitution" &&
+                 parse_char_(tokens[1], a) && parse_char_(tokens[2], b))
+        {
+            if (a != b)
+                set_substitution_(a, b, cost);
+        }
+        else
+            return false;
+        return true;
+    }
+
+    unsigned insertion_;
+    unsigned deletion_;
+    unsigned substitution_;
+    unsigned transposition_;
+    // By character of Latin-1, unset for the default cost
+    uint8_t char_insertion_[256];
+    uint8_t char_deletion_[256];
+    uint8_t latin1_[256][256];
+    // The other characters and pairs, by key_()
+    std::unordered_map<uint64_t, uint8_t> pairs_;
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <queue>
+#include <string>
+#include <vector>
+
+// Sorts (word, freq) entries by word with a bounded amount of memory: the
+// entries are buffered until max_memory is reached, then sorted and spilled
+// to a temporary run file; the runs are merged at the end. Entries with the
+// same word come out in insertion order.
+class ExternalSorter
+{
+public:
+    using entry_t = std::pair<std::string, unsigned>;
+
+    ExternalSorter(size_t max_memory)
+      : max_memory_(max_memory)
+      , memory_(0)
+      , buffer_()
+      , runs_()
+    {
+    }
+
+    ~ExternalSorter()
+    {
+        for (auto run : runs_)
+            fclose(run);
+    }
+
+    ExternalSorter(const ExternalSorter&) = delete;
+    ExternalSorter& operator=(const ExternalSorter&) = delete;
+
+    // Returns false if a run could not be written
+    bool add(const std::string& word, unsigned freq)
+    {
+        buffer_.emplace_back(word, freq);
+        memory_ += sizeof (entry_t) + word.capacity();
+        if (memory_ >= max_memory_)
+            return spill_();
+        return true;
+    }
+
+    // Calls f(word, freq) on every entry, in order. Returns false if a run
+    // could not be written.
+    template <typename F>
+    bool merge(F f)
+    {
+        sort_();
+        if (runs_.empty())
+        {
+            for (const auto& e : buffer_)
+                f(e.first, e.second);
+            return true;
+        }
+        if (!buffer_.empty() && !spill_())
+            return false;
+
+        // (entry, run) with the lowest word on top, the first run on ties
+        using head_t = std::pair<entry_t, size_t>;
+        auto cmp = [](const head_t& a, const head_t& b) {
+            if (a.first.first != b.first.first)
+                return a.first.first > b.first.first;
+            return a.second > b.second;
+        };
+        std::priority_queue<head_t, std::vector<head_t>, decltype(cmp)>
+            heads(cmp);
+        for (size_t r = 0; r < runs_.size(); r++)
+        {
+            rewind(runs_[r]);
+            entry_t e;
+            if (read_(runs_[r], e))
+                heads.push({std::move(e), r});
+        }
+        while (!heads.empty())
+        {
+            head_t h = heads.top();
+            heads.pop();
+            f(h.first.first, h.first.second);
+            if (read_(runs_[h.second], h.first))
+                heads.push(std::move(h));
+        }
+        return true;
+    }
+
+private:
+    void sort_()
+    {
+        std::stable_sort(buffer_.begin(), buffer_.end(),
+                         [](const entry_t& a, const entry_t& b) {
+                             return a.first < b.first;
+                         });
+    }
+
+    // Run files are sequences of (uint32_t len, word, uint32_t freq)
+    bool spill_()
+    {
+        sort_();
+        FILE* run = tmpfile();
+        if (!run)
+            return false;
+        runs_.push_back(run);
+        for (const auto& e : buffer_)
+        {
+            uint32_t len = e.first.size();
+            uint32_t freq = e.second;
+            if (fwrite(&len, sizeof (len), 1, run) != 1 ||
+                fwrite(e.first.data(), 1, len, run) != len ||
+                fwrite(&freq, sizeof (freq), 1, run) != 1)
+                return false;
+        }
+        buffer_.clear();
+        memory_ = 0;
+        return true;
+    }
+
+    static bool read_(FILE* run, entry_t& e)
+    {
+        uint32_t len;
+        uint32_t freq;
+        if (fread(&len, sizeof (len), 1, run) != 1)
+            return false;
+        e.first.resize(len);
+        if (fread(&e.first[0], 1, len, run) != len ||
+            fread(&freq, sizeof (freq), 1, run) != 1)
+            return false;
+        e.second = freq;
+        return true;
+    }
+
+    size_t max_memory_;
+    size_t memory_; // estimated size of the buffer
+    std::vector<entry_t> buffer_;
+    std::vector<FILE*> runs_;
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <charconv>
+#include <limits>
+#include <string>
+
+#include "query-arena.hh"
+
+template <typename T>
+void append_number(std::string& out, T n)
+{
+    char buf[std::numeric_limits<T>::digits10 + 2];
+    auto res = std::to_chars(buf, buf + sizeof (buf), n);
+    out.append(buf, res.ptr);
+}
+
+// Appends n / unit, with as many decimals as needed, unit being a power of
+// 10
+inline void append_fixed(std::string& out, unsigned n, unsigned unit)
+{
+    append_number(out, n / unit);
+    unsigned frac = n % unit;
+    if (!frac)
+        return;
+    out += '.';
+    for (unsigned u = unit / 10; u && frac; u /= 10)
+    {
+        out += static_cast<char>('0' + frac / u);
+        frac %= u;
+    }
+}
+
+// Formats the matches of the arena at the end of out, as JSON. The
+// distances are in units of 1 / unit edit.
+inline void print_matches(std::string& out, const QueryArena& arena,
+                          unsigned unit = 1)
+{
+    const auto& matches = arena.matches();
+    out += '[';
+    for (unsigned i = 0; i < matches.size(); i++)
+    {
+        const auto& r = matches[i];
+        out += "{\"word\":\"";
+        out += arena.word(r);
+        out += "\",\"freq\":";
+        append_number(out, r.freq);
+        out += ",\"distance\":";
+        if (unit == 1)
+            append_number(out, r.distance);
+        else
+            append_fixed(out, r.distance, unit);
+        out += '}';
+        if (i != matches.size() - 1)
+            out += ',';
+    }
+    out += "]\n";
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Cuts the input of a file descriptor in lines. A regular file is mapped
+// entirely; otherwise (a pipe, a terminal) the input is read in large
+// blocks, and only what is already there is used, so that a line is
+// returned as soon as it is complete.
+class LineReader
+{
+public:
+    explicit LineReader(int fd)
+      : fd_(fd)
+      , map_(nullptr)
+      , map_size_(0)
+      , buf_()
+      , begin_(0)
+      , end_(0)
+      , eof_(false)
+    {
+        struct stat s;
+        off_t offset = lseek(fd, 0, SEEK_CUR);
+        if (fstat(fd, &s) == 0 && S_ISREG(s.st_mode) && offset >= 0 &&
+            s.st_size > offset)
+        {
+            void* map = mmap(nullptr, s.st_size, PROT_READ, MAP_PRIVATE, fd,
+                             0);
+            if (map != MAP_FAILED)
+            {
+                madvise(map, s.st_size, MADV_SEQUENTIAL);
+                map_ = static_cast<const char*>(map);
+                map_size_ = s.st_size;
+                begin_ = offset;
+                end_ = s.st_size;
+                eof_ = true;
+                return;
+            }
+        }
+        buf_.resize(block_size);
+    }
+
+    ~LineReader()
+    {
+        if (map_)
+            munmap(const_cast<char*>(map_), map_size_);
+    }
+
+    LineReader(const LineReader&) = delete;
+    LineReader& operator=(const LineReader&) = delete;
+
+    // Sets line to the next line, without its newline, valid until the next
+    // call. Returns false at the end of the input.
+    bool next(std::string_view& line)
+    {
+        for (;;)
+        {
+            const char* data = map_ ? map_ : buf_.data();
+            const char* nl = static_cast<const char*>(
+                    memchr(data + begin_, '\n', end_ - begin_));
+            if (nl)
+            {
+                line = std::string_view(data + begin_, nl - data - begin_);
+                begin_ = nl - data + 1;
+                return true;
+            }
+            if (eof_)
+            {
+                // The last line may not end with a newline
+                line = std::string_view(data + begin_, end_ - begin_);
+                bool res = begin_ < end_;
+                begin_ = end_;
+                return res;
+            }
+            fill_();
+        }
+    }
+
+    // Whether a complete line is already read, i.e. next() won't block
+    bool pending() const
+    {
+        const char* data = map_ ? map_ : buf_.data();
+        return (eof_ && begin_ < end_) ||
+            memchr(data + begin_, '\n', end_ - begin_);
+    }
+
+private:
+    static const size_t block_size = 1 << 20;
+
+    // Reads the next block after the incomplete line
+    void fill_()
+    {
+        if (begin_)
+        {
+            std::memmove(buf_.data(), buf_.data() + begin_, end_ - begin_);
+            end_ -= begin_;
+            begin_ = 0;
+        }
+        if (buf_.size() - end_ < block_size / 2)
+            buf_.resize(2 * buf_.size());
+
+        ssize_t len;
+        do
+            len = read(fd_, buf_.data() + end_, buf_.size() - end_);
+        while (len < 0 && errno == EINTR);
+        if (len <= 0)
+            eof_ = true;
+        else
+            end_ += len;
+    }
+
+    int fd_;
+    const char* map_; // if the input is a regular file
+    size_t map_size_;
+    std::vector<char> buf_;
+    size_t begin_; // of the next line
+    size_t end_;
+    bool eof_;
+};
+
+// Output of a file descriptor written by large blocks: the answers are
+// appended to buffer(), which is written once it is full or by flush().
+class OutputBuffer
+{
+public:
+    explicit OutputBuffer(int fd, size_t capacity = 1 << 20)
+      : fd_(fd)
+      , capacity_(capacity)
+      , buf_()
+      , failed_(false)
+    {
+        buf_.reserve(capacity + (capacity >> 2));
+    }
+
+    ~OutputBuffer()
+    {
+        flush();
+    }
+
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    std::string& buffer()
+    {
+        return buf_;
+    }
+
+    // Writes the buffer if it is full
+    void commit()
+    {
+        if (buf_.size() >= capacity_)
+            flush();
+    }
+
+    void flush()
+    {
+        size_t done = 0;
+        while (!failed_ && done < buf_.size())
+        {
+            ssize_t len = write(fd_, buf_.data() + done, buf_.size() - done);
+            if (len < 0 && errno == EINTR)
+                continue;
+            // The reader is gone: the next answers are dropped
+            if (len < 0)
+                failed_ = true;
+            else
+                done += len;
+        }
+        buf_.clear();
+    }
+
+private:
+    int fd_;
+    size_t capacity_;
+    std::string buf_;
+    bool failed_;
+};
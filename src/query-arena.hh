@@ -0,0 +1,193 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#include "damerau-levenshtein.hh"
+#include "damerau-levenshtein-bitparallel.hh"
+#include "damerau-levenshtein-fixed.hh"
+#include "damerau-levenshtein-utf8.hh"
+#include "damerau-levenshtein-weighted.hh"
+#include "edit-costs.hh"
+
+// Scratch memory of the queries of a thread: the distance automatons and the
+// matches, whose words are stored back to back in a single buffer. It is
+// cleared but never shrunk between two queries, so once warmed up a query
+// does not allocate anything.
+class QueryArena
+{
+public:
+    static const unsigned max_fixed_distance = 4;
+
+    struct match_ref_t
+    {
+        uint32_t offset; // of the word in the buffer
+        uint32_t len;
+        unsigned distance;
+        unsigned freq;
+    };
+    using refs_t = std::vector<match_ref_t>;
+
+    // Work done by the searches, accumulated until reset by the caller
+    struct stats_t
+    {
+        uint64_t nodes; // visited
+        uint64_t cells; // of the distance tables
+    };
+
+    void clear()
+    {
+        words_.clear();
+        matches_.clear();
+        heap_.clear();
+    }
+
+    // Stores a word in the buffer, returns the match referencing it
+    match_ref_t store(const std::string& word, unsigned distance,
+                      unsigned freq)
+    {
+        match_ref_t m{uint32_t(words_.size()), uint32_t(word.size()),
+                      distance, freq};
+        words_.append(word);
+        return m;
+    }
+
+    void add(const std::string& word, unsigned distance, unsigned freq)
+    {
+        matches_.push_back(store(word, distance, freq));
+    }
+
+    // Appends the matches and stats of other, unsorted
+    void merge(const QueryArena& other)
+    {
+        uint32_t shift = words_.size();
+        words_.append(other.words_);
+        for (match_ref_t m : other.matches_)
+        {
+            m.offset += shift;
+            matches_.push_back(m);
+        }
+        stats_.nodes += other.stats_.nodes;
+        stats_.cells += other.stats_.cells;
+    }
+
+    std::string_view word(const match_ref_t& m) const
+    {
+        return std::string_view(words_.data() + m.offset, m.len);
+    }
+
+    // Order of the results: distance, then frequency, then word
+    bool better(const match_ref_t& a, const match_ref_t& b) const
+    {
+        if (a.distance != b.distance)
+            return (a.distance < b.distance);
+        if (b.freq != a.freq)
+            return (b.freq < a.freq);
+        return word(a) < word(b);
+    }
+
+    void sort()
+    {
+        std::sort(matches_.begin(), matches_.end(),
+                  [this](const match_ref_t& a, const match_ref_t& b) {
+                      return better(a, b);
+                  });
+    }
+
+    refs_t& matches()
+    {
+        return matches_;
+    }
+
+    const refs_t& matches() const
+    {
+        return matches_;
+    }
+
+    // Spare vector, used by the top-k search as a heap
+    refs_t& heap()
+    {
+        return heap_;
+    }
+
+    BitParallelDamerauLevenshtein& bit_parallel(const std::string& word,
+                                                unsigned max_dist)
+    {
+        bit_parallel_.reset(word, max_dist);
+        return bit_parallel_;
+    }
+
+    DamerauLevenshtein& table(const std::string& word, unsigned max_dist)
+    {
+        table_.reset(word, max_dist);
+        return table_;
+    }
+
+    // For a maximum distance of N, at most max_fixed_distance
+    template <unsigned N>
+    FixedDamerauLevenshtein<N>& fixed(const std::string& word)
+    {
+        auto& res = std::get<N>(fixed_);
+        res.reset(word);
+        return res;
+    }
+
+    Utf8DamerauLevenshtein& utf8(const std::string& word, unsigned max_dist)
+    {
+        utf8_.reset(word, max_dist);
+        return utf8_;
+    }
+
+    // The distance of utf8() for the longer words
+    WeightedDamerauLevenshtein<UnitCosts>& code_points(
+            const std::string& word, unsigned max_dist)
+    {
+        static const UnitCosts costs;
+        code_points_.reset(word, max_dist, costs);
+        return code_points_;
+    }
+
+    WeightedDamerauLevenshtein<EditCostTable>& weighted(
+            const std::string& word, unsigned max_dist,
+            const EditCostTable& costs)
+    {
+        weighted_.reset(word, max_dist, costs);
+        return weighted_;
+    }
+
+    stats_t& stats()
+    {
+        return stats_;
+    }
+
+    // Words found in the deletion index
+    std::vector<uint32_t>& candidates()
+    {
+        return candidates_;
+    }
+
+    std::string& scratch()
+    {
+        return scratch_;
+    }
+
+private:
+    std::string words_;
+    refs_t matches_;
+    refs_t heap_;
+    BitParallelDamerauLevenshtein bit_parallel_;
+    DamerauLevenshtein table_;
+    std::tuple<FixedDamerauLevenshtein<0>, FixedDamerauLevenshtein<1>,
+               FixedDamerauLevenshtein<2>, FixedDamerauLevenshtein<3>,
+               FixedDamerauLevenshtein<4>> fixed_;
+    Utf8DamerauLevenshtein utf8_;
+    WeightedDamerauLevenshtein<UnitCosts> code_points_;
+    WeightedDamerauLevenshtein<EditCostTable> weighted_;
+    stats_t stats_ = {0, 0};
+    std::vector<uint32_t> candidates_;
+    std::string scratch_;
+};
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "blocking-queue.hh"
+#include "dictionary-overlay.hh"
+#include "dictionary-watcher.hh"
+#include "line-io.hh"
+#include "query.hh"
+#include "thread-pool.hh"
+
+// The loops of the app answering the queries of its standard input, one per
+// line, in the order they are read.
+
+// Number of queries handed to a worker at once in multi-threaded mode
+static const size_t batch_size = 64;
+
+// With batch_search, the queries already read (up to batch_size) are
+// answered together by answer_batch(). The answers are written once the
+// output buffer is full, or before waiting for the next line.
+inline void run_sequential(LineReader& in, OutputBuffer& out,
+                           const DictionaryWatcher& dicts,
+                           OverlayWriter& overlay,
+                           const answer_options_t& options,
+                           bool batch_search)
+{
+    std::vector<QueryArena> arenas(1);
+    std::vector<query_t> queries;
+    auto answer_all = [&]() {
+        if (batch_search)
+            answer_batch(out.buffer(), arenas, queries, *dicts.current(),
+                         *overlay.snapshot(), options);
+        else
+            for (const auto& q : queries)
+                answer(out.buffer(), arenas[0], q, *dicts.current(),
+                       *overlay.snapshot(), options);
+        queries.clear();
+        out.commit();
+    };
+
+    std::string_view line;
+    query_t q;
+    while (in.next(line))
+    {
+        if (!parse_query(line, q))
+            continue;
+        if (q.command != query_t::approx)
+        {
+            if (!queries.empty())
+                answer_all();
+            overlay.add(q.word, q.command == query_t::add ? q.freq : 0);
+            continue;
+        }
+        queries.push_back(std::move(q));
+        bool pending = in.pending();
+        if (!batch_search || queries.size() >= batch_size || !pending)
+            answer_all();
+        if (!pending)
+            out.flush();
+    }
+    if (!queries.empty())
+        answer_all();
+    out.flush();
+}
+
+// A reader thread cuts the input in batches that are answered by the pool.
+// The futures are queued in input order, so the writer (this thread) only
+// has to wait on them one after the other to keep the output ordered. The
+// add and del commands end a batch: the batches read before keep the
+// previous overlay.
+inline void run_parallel(LineReader& in, OutputBuffer& out,
+                         const DictionaryWatcher& dicts,
+                         OverlayWriter& overlay,
+                         const answer_options_t& options,
+                         unsigned nb_threads, bool batch_search)
+{
+    ThreadPool pool(nb_threads);
+    BlockingQueue<std::future<std::string>> pending(4 * pool.size());
+
+    std::thread reader([&]() {
+        std::vector<query_t> batch;
+        auto dispatch = [&]() {
+            auto task = std::make_shared<std::packaged_task<std::string()>>(
+                    [dict = dicts.current(), words = overlay.snapshot(),
+                     queries = std::move(batch), options, batch_search]() {
+                        static thread_local std::vector<QueryArena> arenas(1);
+                        std::string out;
+                        if (batch_search)
+                            answer_batch(out, arenas, queries, *dict, *words,
+                                         options);
+                        else
+                            for (const auto& q : queries)
+                                answer(out, arenas[0], q, *dict, *words,
+                                       options);
+                        return out;
+                    });
+            batch = {};
+            pending.push(task->get_future());
+            pool.submit([task]() { (*task)(); });
+        };
+
+        std::string_view line;
+        query_t q;
+        while (in.next(line))
+        {
+            if (!parse_query(line, q))
+                continue;
+            if (q.command != query_t::approx)
+            {
+                if (!batch.empty())
+                    dispatch();
+                overlay.add(q.word, q.command == query_t::add ? q.freq : 0);
+                continue;
+            }
+            batch.push_back(std::move(q));
+            // Don't hold back a partial batch while waiting for more input
+            if (batch.size() >= batch_size || !in.pending())
+                dispatch();
+        }
+        if (!batch.empty())
+            dispatch();
+        pending.close();
+    });
+
+    // The answers are written before waiting for the next ones
+    std::future<std::string> f;
+    while (pending.try_pop(f) || (out.flush(), pending.pop(f)))
+    {
+        if (f.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            out.flush();
+        out.buffer() += f.get();
+        out.commit();
+    }
+    out.flush();
+    reader.join();
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "compact-radix-trie.hh"
+#include "dictionary-overlay.hh"
+#include "dictionary.hh"
+#include "edit-costs.hh"
+#include "json-output.hh"
+#include "query-arena.hh"
+#include "result-cache.hh"
+#include "tokenizer.hh"
+#include "work-stealing-pool.hh"
+
+struct query_t
+{
+    enum command_t
+    {
+        approx,
+        add, // word with freq, which replaces its frequency
+        del, // word
+    };
+
+    int max_dist;
+    std::string word;
+    int top; // number of results of an approx-top query, -1 for all of them
+    command_t command;
+    unsigned freq;
+};
+
+// How the queries of a run are answered
+struct answer_options_t
+{
+    ResultCache* cache = nullptr; // keeping the answers, if any
+    // Weighted distances, if any: they are then searched in the trie even
+    // when the dictionary has a deletion index, and never in batches
+    const EditCostTable* costs = nullptr;
+    // Distances between code points rather than bytes, as the weighted ones
+    bool utf8 = false;
+    // Pool walking the parts of the approx queries on bytes that visit more
+    // than split_budget nodes, if any (see CompactRadixTrie::parallel_matches)
+    WorkStealingPool* pool = nullptr;
+    uint64_t split_budget = 0;
+};
+
+// Formats the answer to q at the end of out. The add and del commands have
+// no answer: they are applied to the overlay before the next queries.
+inline void answer(std::string& out, QueryArena& arena, const query_t& q,
+                   const char* start, const DictionaryOverlay& overlay,
+                   const answer_options_t& options = answer_options_t())
+{
+    const EditCostTable* costs = options.costs;
+    if (q.max_dist >= 0 && costs)
+    {
+        unsigned max_cost = q.max_dist * EditCostTable::unit;
+        if (q.top >= 0)
+            CompactRadixTrie::weighted_top_matches(arena, q.word, start,
+                                                   q.top, max_cost, *costs,
+                                                   overlay);
+        else
+            CompactRadixTrie::weighted_matches(arena, q.word, start,
+                                               max_cost, *costs, overlay);
+        print_matches(out, arena, EditCostTable::unit);
+        return;
+    }
+    if (q.max_dist >= 0 && options.utf8)
+    {
+        if (q.top >= 0)
+            CompactRadixTrie::utf8_top_matches(arena, q.word, start, q.top,
+                                               q.max_dist, overlay);
+        else
+            CompactRadixTrie::utf8_matches(arena, q.word, start, q.max_dist,
+                                           overlay);
+    }
+    else if (q.max_dist >= 0 && q.top >= 0)
+        CompactRadixTrie::top_matches(arena, q.word, start, q.top,
+                                      q.max_dist, overlay);
+    else if (q.max_dist >= 0 && options.pool)
+        CompactRadixTrie::parallel_matches(arena, q.word, start, q.max_dist,
+                                           overlay, *options.pool,
+                                           options.split_budget);
+    else if (q.max_dist >= 0)
+        CompactRadixTrie::matches(arena, q.word, start, q.max_dist, overlay);
+    else
+        arena.clear();
+    print_matches(out, arena);
+}
+
+// Key of the answer to q in a ResultCache
+inline std::string cache_key(const query_t& q)
+{
+    return std::to_string(q.max_dist) + ' ' + std::to_string(q.top) + ' ' +
+        q.word;
+}
+
+// Same as answer(), through the cache if there is one
+inline void answer(std::string& out, QueryArena& arena, const query_t& q,
+                   const Dictionary& dict, const DictionaryOverlay& overlay,
+                   const answer_options_t& options)
+{
+    ResultCache* cache = options.cache;
+    if (!cache || q.max_dist < 0)
+    {
+        answer(out, arena, q, dict.start(), overlay, options);
+        return;
+    }
+    ResultCache::version_t version{dict.id(), overlay.version()};
+    std::string key = cache_key(q);
+    if (cache->get(key, version, out))
+        return;
+    size_t begin = out.size();
+    answer(out, arena, q, dict.start(), overlay, options);
+    cache->put(key, version, std::string_view(out).substr(begin));
+}
+
+// Same as answer() for each query, but searching the approx queries missing
+// from the cache together (see CompactRadixTrie::batch_matches), on bytes
+// with unit costs. The queries searched with an overlay, weighted distances
+// or on code points are answered one by one.
+inline void answer_batch(std::string& out, std::vector<QueryArena>& arenas,
+                         const std::vector<query_t>& queries,
+                         const Dictionary& dict,
+                         const DictionaryOverlay& overlay,
+                         const answer_options_t& options)
+{
+    if (arenas.size() < std::max<size_t>(queries.size(), 1))
+        arenas.resize(std::max<size_t>(queries.size(), 1));
+    if (!overlay.empty() || options.costs || options.utf8)
+    {
+        for (const auto& q : queries)
+            answer(out, arenas[0], q, dict, overlay, options);
+        return;
+    }
+
+    ResultCache* cache = options.cache;
+    ResultCache::version_t version{dict.id(), overlay.version()};
+    std::vector<std::string> cached(queries.size());
+    std::vector<bool> hit(queries.size(), false);
+    std::vector<CompactRadixTrie::batch_query_t> batch;
+    for (size_t i = 0; i < queries.size(); i++)
+    {
+        const query_t& q = queries[i];
+        if (cache && q.max_dist >= 0)
+            hit[i] = cache->get(cache_key(q), version, cached[i]);
+        if (!hit[i] && q.max_dist >= 0 && q.top < 0)
+            batch.push_back({&arenas[i], &q.word, unsigned(q.max_dist)});
+    }
+    CompactRadixTrie::batch_matches(batch, dict.start());
+
+    for (size_t i = 0; i < queries.size(); i++)
+    {
+        const query_t& q = queries[i];
+        size_t begin = out.size();
+        if (hit[i])
+        {
+            out += cached[i];
+            continue;
+        }
+        if (q.max_dist >= 0 && q.top < 0)
+            print_matches(out, arenas[i]);
+        else
+            answer(out, arenas[i], q, dict.start(), overlay);
+        if (cache && q.max_dist >= 0)
+            cache->put(cache_key(q), version,
+                       std::string_view(out).substr(begin));
+    }
+}
+
+// Reads a query from a single line, returns false if the line is blank. A
+// malformed query (unknown command, missing or invalid number, missing word)
+// gets a negative max_dist, and an empty answer.
+inline bool parse_query(std::string_view line, query_t& q)
+{
+    size_t pos = 0;
+    q.word.clear();
+    q.max_dist = -1;
+    q.top = -1;
+    q.command = query_t::approx;
+    q.freq = 0;
+
+    std::string_view approx = next_token(line, pos);
+    if (approx.empty())
+        return false;
+    if (approx == "add" || approx == "del")
+    {
+        bool add = approx == "add";
+        std::string_view word = next_token(line, pos);
+        if (!word.empty() &&
+            (!add || parse_number(next_token(line, pos), q.freq)))
+            q.command = add ? query_t::add : query_t::del;
+        q.word = word;
+        return true;
+    }
+
+    bool top = approx == "approx-top";
+    int max_dist = -1;
+    if ((approx != "approx" && !top) ||
+        (top && (!parse_number(next_token(line, pos), q.top) ||
+                 q.top < 0)) ||
+        !parse_number(next_token(line, pos), max_dist))
+        return true;
+    std::string_view word = next_token(line, pos);
+    if (!word.empty())
+    {
+        q.word = word;
+        q.max_dist = max_dist;
+    }
+    return true;
+}
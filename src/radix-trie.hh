@@ -1,15 +1,23 @@
 #pragma once
 
 #include <cassert>
+#include <climits>
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
 #include <iostream>
 #include <memory>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
+#include "checksum.hh"
 #include "compact-radix-trie.hh"
 #include "damerau-levenshtein.hh"
+#include "delete-index-builder.hh"
+#include "thread-pool.hh"
+#include "tokenizer.hh"
 
 #ifndef NDEBUG
 # define DEBUG(fmt, ...) fprintf(stderr, "debug: " fmt "\n", __VA_ARGS__)
@@ -43,6 +51,88 @@ public:
         }
     }
 
+    // Same as load() on the text of a file of "word freq" lines, on
+    // nb_threads threads. The lines are parsed by chunks, and the words
+    // split by first character: each subtree of the root is built by a
+    // thread from its words in the order of the text, then the subtrees are
+    // put under the root in the order load() would have created them.
+    // Returns nullptr and sets error if a line is malformed.
+    static std::unique_ptr<RadixTrie> load(std::string_view text,
+                                           unsigned nb_threads,
+                                           std::string& error)
+    {
+        struct entry_t
+        {
+            std::string_view word;
+            unsigned freq;
+        };
+        struct chunk_t
+        {
+            std::string_view text;
+            std::vector<entry_t> words[256]; // by first character
+            std::vector<uint8_t> first_chars; // by first appearance
+            std::string_view malformed;
+        };
+
+        // A chunk ends at the first newline after its share of the text,
+        // and the next one starts after that newline
+        const size_t min_chunk = 1 << 12;
+        size_t nb_chunks = nb_threads > 1
+            ? std::min<size_t>(4 * nb_threads, text.size() / min_chunk + 1)
+            : 1;
+        std::vector<chunk_t> chunks(nb_chunks);
+        size_t begin = 0;
+        for (size_t i = 0; i < nb_chunks; i++)
+        {
+            size_t end = std::max(begin, text.size() * (i + 1) / nb_chunks);
+            end = std::min(text.find('\n', end), text.size());
+            chunks[i].text = text.substr(begin, end - begin);
+            begin = std::min(end + 1, text.size());
+        }
+
+        {
+            ThreadPool pool(nb_threads);
+            for (auto& chunk : chunks)
+                pool.submit([&chunk]() { parse_chunk_(chunk); });
+        }
+        for (const auto& chunk : chunks)
+            if (!chunk.malformed.empty())
+            {
+                error = "Malformed line: " + std::string(chunk.malformed);
+                return nullptr;
+            }
+
+        std::unique_ptr<RadixTrie> subtrees[256];
+        {
+            ThreadPool pool(nb_threads);
+            for (size_t c = 0; c < 256; c++)
+                pool.submit([&chunks, &subtrees, c]() {
+                        auto trie = std::make_unique<RadixTrie>();
+                        std::string word;
+                        for (const auto& chunk : chunks)
+                            for (const auto& e : chunk.words[c])
+                            {
+                                word.assign(e.word);
+                                trie->add_word(e.freq, word);
+                            }
+                        if (!trie->children_.empty())
+                            subtrees[c] = std::move(trie);
+                });
+        }
+
+        // Each subtree has a single edge, starting with its character
+        auto res = std::make_unique<RadixTrie>();
+        for (const auto& chunk : chunks)
+            for (auto c : chunk.first_chars)
+                if (subtrees[c])
+                {
+                    res->children_.push_back(
+                            std::move(subtrees[c]->children_[0]));
+                    subtrees[c].reset();
+                }
+        return res;
+    }
+
     void add_word(unsigned freq, const std::string& word, size_t start = 0)
     {
         assert(start <= word.size());
@@ -82,6 +172,47 @@ public:
         }
     }
 
+    // Removes word, returns false if it was not in the trie. The nodes left
+    // without a word nor children are removed, and the ones left with a
+    // single child are merged with it.
+    bool remove_word(const std::string& word, size_t start = 0)
+    {
+        assert(start <= word.size());
+        if (word.size() == start)
+        {
+            bool res = freq_ != 0;
+            freq_ = 0;
+            return res;
+        }
+        int e = edge_start_(word[start]);
+        if (e == -1)
+            return false;
+        auto& edge = children_[e];
+        if (word.compare(start, edge.first.size(), edge.first) ||
+            !edge.second->remove_word(word, start + edge.first.size()))
+            return false;
+        RadixTrie& child = *edge.second;
+        if (!child.freq_ && child.children_.empty())
+            children_.erase(children_.begin() + e);
+        else if (!child.freq_ && child.children_.size() == 1)
+        {
+            edge_t next = std::move(child.children_[0]);
+            edge.first += next.first;
+            edge.second = std::move(next.second);
+        }
+        return true;
+    }
+
+    unsigned freq() const
+    {
+        return freq_;
+    }
+
+    const std::vector<edge_t>& children() const
+    {
+        return children_;
+    }
+
     void serialize(std::ostream& out) const
     {
         size_t nb_children = children_.size();
@@ -121,7 +252,87 @@ public:
         return deserialize_mem_(&start);
     }
 
-    void serialize_compact(std::ostream& out) const
+    // Writes the trie in the current compact format (see compact-format.hh),
+    // the nodes being placed in the file following the given layout. If
+    // index_depth is not 0, the trie is followed by a DeleteIndex of the
+    // variants with up to index_depth deletions. With several threads, the
+    // index and the subtrees of the root are written in parallel (the
+    // subtrees only in the dfs layout, where each of them is contiguous).
+    // Returns false, writing nothing, if the nodes are too big for the 32-bit
+    // offsets of the format.
+    bool serialize_compact(std::ostream& out,
+                           CompactLayout layout = CompactLayout::dfs,
+                           unsigned index_depth = 0,
+                           size_t index_prefix = 0,
+                           unsigned nb_threads = 1) const
+    {
+        using Header = CompactFormat::Header;
+
+        std::string index;
+        auto build_index = [&]() {
+            DeleteIndexBuilder builder(index_depth, index_prefix);
+            std::string word;
+            for_each_word_(word, [&](const std::string& w, unsigned freq) {
+                    builder.add(w, freq);
+            });
+            index = builder.finish();
+        };
+        std::thread index_thread;
+        if (index_depth && nb_threads > 1)
+            index_thread = std::thread(build_index);
+        else if (index_depth)
+            build_index();
+
+        // Offsets are relative, the nodes don't depend on where they are
+        std::string nodes;
+        size_t root;
+        bool fits;
+        if (layout == CompactLayout::dfs && nb_threads > 1)
+            fits = write_subtrees_(nodes, nb_threads, root);
+        else
+        {
+            std::vector<unit_t> units;
+            flatten_(units);
+            fits = write_units_(nodes, units, layout_(units, layout), root);
+        }
+        if (index_thread.joinable())
+            index_thread.join();
+
+        size_t size = sizeof (Header) + nodes.size();
+        if (!fits || size > INT32_MAX)
+            return false;
+        size_t index_pos = size + (index.empty() ? 0 :
+                (DeleteIndex::alignment - size % DeleteIndex::alignment) %
+                DeleteIndex::alignment);
+
+        Header header;
+        memset(&header, 0, sizeof (header));
+        memcpy(header.magic, CompactFormat::magic, sizeof (header.magic));
+        header.version = CompactFormat::version;
+        header.size = index_pos + index.size();
+        header.root = sizeof (Header) + root;
+        header.index = index.empty() ? 0 : index_pos;
+        std::streamoff header_pos = out.tellp();
+        write_(out, header);
+
+        // The rest goes through the checksum, then the header is written
+        // again with it
+        ChecksumBuf sum(out.rdbuf());
+        std::ostream body(&sum);
+        body.write(nodes.data(), nodes.size());
+        for (size_t i = size; i < index_pos; i++)
+            body.put(0);
+        body.write(index.data(), index.size());
+
+        header.checksum = sum.value();
+        out.seekp(header_pos);
+        write_(out, header);
+        out.seekp(0, std::ios::end);
+        return true;
+    }
+
+    // Writes the trie in the legacy compact format
+    void serialize_compact_v1(std::ostream& out) const
     {
         size_t nb_children = children_.size();
         size_t zero = 0;
@@ -152,29 +363,55 @@ public:
             out.write(p.first.c_str(), lsize);
 
             // child
-            p.second->serialize_compact(out);
+            p.second->serialize_compact_v1(out);
         }
     }
 
-    static std::unique_ptr<RadixTrie> deserialize_compact(const char* start)
+    // Writes the trie in the minimized format (see CompactDawgFormat): the
+    // subtrees with the same labels and words are written once. Returns
+    // false, writing nothing, if they are too big for its 32-bit offsets.
+    bool serialize_dawg(std::ostream& out) const
     {
-        using CompactHead = CompactRadixTrie::CompactHead;
-        using CompactChild = CompactRadixTrie::CompactChild;
+        using Header = CompactDawgFormat::Header;
 
-        auto res = std::make_unique<RadixTrie>();
+        dawg_writer_t writer;
+        writer.buf.resize(sizeof (Header));
+        uint32_t root = dawg_root_(writer, *this);
 
-        const CompactHead* h = reinterpret_cast<const CompactHead*>(start);
-        res->freq_ = h->freq;
+        std::vector<uint32_t> freqs;
+        freqs_(freqs);
+        uint32_t freqs_pos = writer.buf.size();
+        writer.buf.append(reinterpret_cast<const char*>(freqs.data()),
+                          freqs.size() * sizeof (uint32_t));
+        if (writer.buf.size() > INT32_MAX)
+            return false;
 
-        for (size_t c = 0; c < h->nb_children; ++c)
-        {
-            const char* cha = start + h->offset[c];
-            const CompactChild* ch = reinterpret_cast<const CompactChild*>(cha);
-            const char* caddr = cha + sizeof (size_t) + ch->label_len;
-            res->children_.push_back({std::string(ch->label, ch->label_len),
-                                      deserialize_compact(caddr)});
-        }
-        return res;
+        Header header;
+        memset(&header, 0, sizeof (header));
+        memcpy(header.magic, CompactDawgFormat::magic, sizeof (header.magic));
+        header.version = CompactDawgFormat::version;
+        header.size = writer.buf.size();
+        header.root = root;
+        header.freqs = freqs_pos;
+        header.nb_words = freqs.size();
+        header.checksum = Checksum::of(writer.buf.data() + sizeof (header),
+                                       writer.buf.size() - sizeof (header));
+        memcpy(&writer.buf[0], &header, sizeof (header));
+        out.write(writer.buf.data(), writer.buf.size());
+        return true;
+    }
+
+    // Reads a trie in any of the compact formats
+    static std::unique_ptr<RadixTrie> deserialize_compact(const char* start)
+    {
+        if (CompactFormat::is(start))
+            return deserialize_compact_<CompactFormat>(
+                    CompactFormat::root(start));
+        if (CompactDawgFormat::is(start))
+            return deserialize_compact_<CompactDawgFormat>(
+                    CompactDawgFormat::root(start));
+        return deserialize_compact_<CompactFormatV1>(
+                CompactFormatV1::root(start));
     }
 
     unsigned lookup(const std::string& word, size_t start = 0) const
@@ -215,6 +452,504 @@ public:
     }
 
 private:
+    // Splits the lines of chunk.text by first character, see load()
+    template <typename C>
+    static void parse_chunk_(C& chunk)
+    {
+        bool seen[256] = {};
+        std::string_view text = chunk.text;
+        while (!text.empty())
+        {
+            size_t end = std::min(text.find('\n'), text.size());
+            std::string_view line = text.substr(0, end);
+            text.remove_prefix(std::min(end + 1, text.size()));
+
+            size_t pos = 0;
+            unsigned freq;
+            std::string_view word = next_token(line, pos);
+            if (word.empty())
+                continue;
+            if (!parse_number(next_token(line, pos), freq) ||
+                !next_token(line, pos).empty())
+            {
+                chunk.malformed = line;
+                return;
+            }
+            uint8_t c = word[0];
+            chunk.words[c].push_back({word, freq});
+            if (!seen[c])
+                chunk.first_chars.push_back(c);
+            seen[c] = true;
+        }
+    }
+
+    template <typename T>
+    static void write_(std::ostream& out, const T& value)
+    {
+        out.write(reinterpret_cast<const char*>(&value), sizeof (T));
+    }
+
+    // A node of the compact trie along with the label of the edge leading to
+    // it. Labels too long for the format are split over intermediate units.
+    struct unit_t
+    {
+        const char* label;
+        uint32_t label_len;
+        uint32_t freq;
+        uint32_t max_freq;
+        uint32_t first_child; // the children of a unit are consecutive
+        uint32_t nb_children;
+        CompactFormat::Bounds bounds;
+
+        size_t edge_size() const
+        {
+            if (!label)
+                return 0; // root
+            return 1 + label_len + CompactFormat::padding(1 + label_len);
+        }
+
+        size_t head_size() const
+        {
+            return 4 * sizeof (uint32_t) + nb_children * sizeof (int32_t) +
+                nb_children + CompactFormat::padding(nb_children);
+        }
+    };
+
+    // Order of the siblings: decreasing max_freq, then label
+    static bool before_(const unit_t& a, const unit_t& b)
+    {
+        if (a.max_freq != b.max_freq)
+            return a.max_freq > b.max_freq;
+        return std::lexicographical_compare(a.label, a.label + a.label_len,
+                                            b.label, b.label + b.label_len);
+    }
+
+    // Lists the units in breadth-first order, the root (or the first unit of
+    // edge, a child of the root) being the first one
+    void flatten_(std::vector<unit_t>& units,
+                  const edge_t* edge = nullptr) const
+    {
+        // node and label of the edge each unit is part of
+        struct edge_ref_t
+        {
+            const RadixTrie* node;
+            const std::string* label;
+            size_t end; // of the part of the label held by the unit
+        };
+        std::vector<edge_ref_t> edges;
+
+        auto push = [&](const RadixTrie* node, const std::string* label,
+                        size_t begin) {
+            size_t len = std::min(label->size() - begin,
+                                  CompactFormat::max_label_len);
+            bool last = begin + len == label->size();
+            unsigned freq = last ? node->freq_ : 0;
+            units.push_back(unit_t{label->c_str() + begin, uint32_t(len),
+                                   freq, freq, 0, 0, {}});
+            edges.push_back(edge_ref_t{node, label, begin + len});
+        };
+
+        if (edge)
+            push(edge->second.get(), &edge->first, 0);
+        else
+        {
+            units.push_back(unit_t{nullptr, 0, freq_, freq_, 0, 0, {}});
+            edges.push_back(edge_ref_t{this, nullptr, 0});
+        }
+        for (size_t u = 0; u < units.size(); u++)
+        {
+            edge_ref_t e = edges[u];
+            units[u].first_child = units.size();
+            if (e.label && e.end < e.label->size())
+                push(e.node, e.label, e.end);
+            else
+                for (const auto& p : e.node->children_)
+                    push(p.second.get(), &p.first, 0);
+            units[u].nb_children = units.size() - units[u].first_child;
+        }
+
+        // children have greater indices than their parent
+        for (size_t u = units.size(); u--; )
+        {
+            unit_t& unit = units[u];
+            auto first = units.begin() + unit.first_child;
+            auto last = first + unit.nb_children;
+            unit.bounds = CompactFormat::Bounds::of_node(unit.freq != 0);
+            for (auto it = first; it != last; ++it)
+            {
+                unit.max_freq = std::max(unit.max_freq, it->max_freq);
+                unit.bounds.add_child(it->bounds);
+            }
+            unit.bounds.add_label(unit.label, unit.label_len);
+            std::sort(first, last, before_);
+        }
+    }
+
+    // Appends the units to buf in the given order, sets first to the
+    // position of the first unit in buf. Returns false, appending nothing,
+    // if buf would be too big for the 32-bit offsets.
+    static bool write_units_(std::string& buf,
+                             const std::vector<unit_t>& units,
+                             const std::vector<uint32_t>& order,
+                             size_t& first)
+    {
+        std::vector<uint32_t> pos(units.size());
+        size_t size = buf.size();
+        for (auto u : order)
+        {
+            pos[u] = size;
+            size += units[u].edge_size() + units[u].head_size();
+        }
+        if (size > INT32_MAX)
+            return false;
+        buf.reserve(size);
+
+        for (auto u : order)
+        {
+            const unit_t& unit = units[u];
+            size_t head = pos[u] + unit.edge_size();
+
+            // CompactChild
+            if (unit.label)
+            {
+                append_(buf, uint8_t(unit.label_len));
+                buf.append(unit.label, unit.label_len);
+                buf.append(CompactFormat::padding(1 + unit.label_len), '\0');
+            }
+
+            // CompactHead
+            append_(buf, uint32_t(unit.freq));
+            append_(buf, uint32_t(unit.max_freq));
+            append_bounds_(buf, unit.nb_children, unit.bounds);
+            for (size_t c = 0; c < unit.nb_children; ++c)
+                append_(buf, int32_t(pos[unit.first_child + c] - head));
+            for (size_t c = 0; c < unit.nb_children; ++c)
+                buf += units[unit.first_child + c].label[0];
+            buf.append(CompactFormat::padding(unit.nb_children), '\0');
+        }
+        first = pos[0];
+        return true;
+    }
+
+    // Same as write_units_() in the dfs layout, each subtree of the root
+    // being written by one of nb_threads threads. Since they are contiguous
+    // in this layout, they are then concatenated after the root.
+    bool write_subtrees_(std::string& buf, unsigned nb_threads,
+                         size_t& first) const
+    {
+        struct subtree_t
+        {
+            unit_t first; // the root of the subtree
+            std::string nodes;
+            bool fits; // see write_units_()
+        };
+        std::vector<subtree_t> subtrees(children_.size());
+        {
+            ThreadPool pool(nb_threads);
+            for (size_t c = 0; c < children_.size(); c++)
+                pool.submit([this, c, &subtrees]() {
+                        std::vector<unit_t> units;
+                        flatten_(units, &children_[c]);
+                        size_t pos;
+                        subtrees[c].fits = write_units_(subtrees[c].nodes,
+                                units, layout_(units, CompactLayout::dfs),
+                                pos);
+                        subtrees[c].first = units[0];
+                });
+        }
+
+        std::vector<uint32_t> order(subtrees.size());
+        for (size_t c = 0; c < order.size(); c++)
+            order[c] = c;
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+                return before_(subtrees[a].first, subtrees[b].first);
+        });
+
+        unit_t root{nullptr, 0, freq_, freq_, 0, uint32_t(order.size()),
+                    CompactFormat::Bounds::of_node(freq_ != 0)};
+        for (const auto& t : subtrees)
+        {
+            if (!t.fits)
+                return false;
+            root.max_freq = std::max(root.max_freq, t.first.max_freq);
+            root.bounds.add_child(t.first.bounds);
+        }
+        size_t head = buf.size();
+        size_t end = head + root.head_size();
+        for (const auto& t : subtrees)
+            end += t.nodes.size();
+        if (end > INT32_MAX)
+            return false;
+
+        size_t pos = head + root.head_size();
+        append_(buf, uint32_t(root.freq));
+        append_(buf, uint32_t(root.max_freq));
+        append_bounds_(buf, root.nb_children, root.bounds);
+        for (auto c : order)
+        {
+            append_(buf, int32_t(pos - head));
+            pos += subtrees[c].nodes.size();
+        }
+        for (auto c : order)
+            buf += subtrees[c].first.label[0];
+        buf.append(CompactFormat::padding(root.nb_children), '\0');
+        for (auto c : order)
+            buf += subtrees[c].nodes;
+        first = head;
+        return true;
+    }
+
+    static std::vector<uint32_t> layout_(const std::vector<unit_t>& units,
+                                         CompactLayout layout)
+    {
+        std::vector<uint32_t> order;
+        order.reserve(units.size());
+        switch (layout)
+        {
+        case CompactLayout::bfs:
+            for (size_t u = 0; u < units.size(); u++)
+                order.push_back(u);
+            break;
+        case CompactLayout::dfs:
+            {
+                std::vector<uint32_t> stack = {0};
+                while (!stack.empty())
+                {
+                    uint32_t u = stack.back();
+                    stack.pop_back();
+                    order.push_back(u);
+                    for (size_t c = units[u].nb_children; c--; )
+                        stack.push_back(units[u].first_child + c);
+                }
+            }
+            break;
+        case CompactLayout::veb:
+            {
+                // children have greater indices than their parent
+                std::vector<uint32_t> height(units.size(), 1);
+                for (size_t u = units.size(); u--; )
+                    for (size_t c = 0; c < units[u].nb_children; ++c)
+                        height[u] = std::max(height[u],
+                                height[units[u].first_child + c] + 1);
+                layout_veb_(units, height, order, 0, height[0]);
+            }
+            break;
+        }
+        assert(order.size() == units.size());
+        return order;
+    }
+
+    // Lays out the nodes of the subtree of root at depth lower than height:
+    // first the top half of the levels, then each of the subtrees below.
+    static void layout_veb_(const std::vector<unit_t>& units,
+                            const std::vector<uint32_t>& height,
+                            std::vector<uint32_t>& order,
+                            uint32_t root, uint32_t max_height)
+    {
+        max_height = std::min(max_height, height[root]);
+        if (max_height == 1)
+        {
+            order.push_back(root);
+            return;
+        }
+        uint32_t top = (max_height + 1) / 2;
+        layout_veb_(units, height, order, root, top);
+
+        // roots of the bottom trees, in depth-first order
+        std::vector<std::pair<uint32_t, uint32_t>> stack = {{root, 0}};
+        while (!stack.empty())
+        {
+            auto p = stack.back();
+            stack.pop_back();
+            if (p.second == top)
+            {
+                layout_veb_(units, height, order, p.first, max_height - top);
+                continue;
+            }
+            const unit_t& unit = units[p.first];
+            for (size_t c = unit.nb_children; c--; )
+                stack.push_back({unit.first_child + c, p.second + 1});
+        }
+    }
+
+    // The minimized file being built, and the units already in it. A unit is
+    // a CompactChild and the CompactHead of its node, the key of a unit being
+    // its label, whether the node is final and the units of its children.
+    struct dawg_writer_t
+    {
+        struct unit_ref_t
+        {
+            uint32_t pos;
+            uint32_t nb_words; // in the subtree
+        };
+
+        std::string buf;
+        std::unordered_map<std::string, unit_ref_t> units;
+    };
+
+    template <typename T>
+    static void append_(std::string& buf, const T& value)
+    {
+        buf.append(reinterpret_cast<const char*>(&value), sizeof (T));
+    }
+
+    // The fields of a CompactHead after max_freq
+    static void append_bounds_(std::string& buf, size_t nb_children,
+                               const CompactFormat::Bounds& bounds)
+    {
+        append_(buf, uint16_t(nb_children));
+        append_(buf, bounds.min_len);
+        append_(buf, bounds.max_len);
+        append_(buf, bounds.chars);
+    }
+
+    template <typename Fn>
+    void for_each_word_(std::string& word, Fn f) const
+    {
+        if (freq_)
+            f(word, freq_);
+        for (const auto& p : children_)
+        {
+            word += p.first;
+            p.second->for_each_word_(word, f);
+            word.resize(word.size() - p.first.size());
+        }
+    }
+
+    // Frequencies of the words in byte order
+    void freqs_(std::vector<uint32_t>& freqs) const
+    {
+        if (freq_)
+            freqs.push_back(freq_);
+        for (auto c : sorted_children_())
+            children_[c].second->freqs_(freqs);
+    }
+
+    std::vector<uint32_t> sorted_children_() const
+    {
+        std::vector<uint32_t> res(children_.size());
+        for (size_t c = 0; c < res.size(); c++)
+            res[c] = c;
+        std::sort(res.begin(), res.end(), [this](uint32_t a, uint32_t b) {
+                return uint8_t(children_[a].first[0]) <
+                    uint8_t(children_[b].first[0]);
+        });
+        return res;
+    }
+
+    // Writes the units of the children of the node, in byte order
+    static void dawg_children_(
+            dawg_writer_t& w, const RadixTrie& node,
+            std::vector<dawg_writer_t::unit_ref_t>& children,
+            std::string& keys)
+    {
+        for (auto c : node.sorted_children_())
+        {
+            const auto& edge = node.children_[c];
+            children.push_back(dawg_unit_(w, edge.first.data(),
+                                          edge.first.size(), *edge.second));
+            keys += edge.first[0];
+        }
+    }
+
+    // Writes the root CompactHead after its children, returns its position
+    static uint32_t dawg_root_(dawg_writer_t& w, const RadixTrie& root)
+    {
+        std::vector<dawg_writer_t::unit_ref_t> children;
+        std::string keys;
+        dawg_children_(w, root, children, keys);
+        uint32_t head = w.buf.size();
+        dawg_write_head_(w.buf, head, root.freq_ != 0, children, keys);
+        return head;
+    }
+
+    // Appends a CompactHead to buf, as if it was at position head. Since the
+    // offsets depend on the position, the key of a unit is the CompactHead
+    // it would have at position 0.
+    static void dawg_write_head_(
+            std::string& buf, uint32_t head, bool final,
+            const std::vector<dawg_writer_t::unit_ref_t>& children,
+            const std::string& keys)
+    {
+        uint32_t info = children.size();
+        if (final)
+            info |= CompactDawgFormat::final_bit;
+        append_(buf, info);
+        for (const auto& c : children)
+            append_(buf, int32_t(int64_t(c.pos) - head));
+        uint32_t rank = final;
+        for (const auto& c : children)
+        {
+            append_(buf, rank);
+            rank += c.nb_words;
+        }
+        buf += keys;
+        buf.append(CompactDawgFormat::padding(keys.size()), '\0');
+    }
+
+    // Writes the unit of the edge with the given label leading to node, unless
+    // an equivalent one was already written
+    static dawg_writer_t::unit_ref_t
+    dawg_unit_(dawg_writer_t& w, const char* label, size_t len,
+               const RadixTrie& node)
+    {
+        std::vector<dawg_writer_t::unit_ref_t> children;
+        std::string keys;
+        bool final = node.freq_ != 0;
+        // Long labels are split, the last part leading to the node itself
+        const size_t max_len = CompactDawgFormat::max_label_len;
+        if (len > max_len)
+        {
+            children.push_back(dawg_unit_(w, label + max_len, len - max_len,
+                                          node));
+            keys += label[max_len];
+            final = false;
+            len = max_len;
+        }
+        else
+            dawg_children_(w, node, children, keys);
+
+        std::string key;
+        append_(key, uint8_t(len));
+        key.append(label, len);
+        dawg_write_head_(key, 0, final, children, keys);
+        auto it = w.units.find(key);
+        if (it != w.units.end())
+            return it->second;
+
+        uint32_t nb_words = final;
+        for (const auto& c : children)
+            nb_words += c.nb_words;
+        dawg_writer_t::unit_ref_t ref{uint32_t(w.buf.size()), nb_words};
+        w.buf.append(key, 0, 1 + len);
+        w.buf.append(CompactDawgFormat::padding(1 + len), '\0');
+        dawg_write_head_(w.buf, w.buf.size(), final, children, keys);
+        w.units.emplace(std::move(key), ref);
+        return ref;
+    }
+
+    template <typename F>
+    static std::unique_ptr<RadixTrie>
+    deserialize_compact_(typename F::node_t h)
+    {
+        auto res = std::make_unique<RadixTrie>(F::freq(h));
+
+        for (size_t c = 0; c < F::nb_children(h); ++c)
+        {
+            auto ch = F::child(h, c);
+            std::string label(F::label(ch), F::label_len(ch));
+            auto child = deserialize_compact_<F>(F::head(ch));
+            // Merge back the labels that were split by the serialization
+            if (!child->freq_ && child->children_.size() == 1)
+            {
+                label += child->children_[0].first;
+                child = std::move(child->children_[0].second);
+            }
+            res->children_.push_back({label, std::move(child)});
+        }
+        return res;
+    }
+
     static std::unique_ptr<RadixTrie> deserialize_mem_(const char** start)
     {
         auto res = std::make_unique<RadixTrie>();
@@ -287,3 +1022,54 @@ private:
     std::vector<edge_t> children_;
     unsigned freq_; // 0 if not final
 };
+
+// Accessors in the style of the compact formats, for the searches of
+// CompactRadixTrie to walk a RadixTrie
+struct RadixTrieFormat
+{
+    static const bool bounded = false;
+
+    using node_t = const RadixTrie*;
+    using edge_t = const RadixTrie::edge_t*;
+
+    static unsigned freq(node_t node)
+    {
+        return node->freq();
+    }
+
+    // The children are not sorted, nothing can be pruned
+    static unsigned max_freq(node_t)
+    {
+        return UINT_MAX;
+    }
+
+    static size_t nb_children(node_t node)
+    {
+        return node->children().size();
+    }
+
+    static edge_t child(node_t node, size_t c)
+    {
+        return &node->children()[c];
+    }
+
+    static size_t label_len(edge_t edge)
+    {
+        return edge->first.size();
+    }
+
+    static const char* label(edge_t edge)
+    {
+        return edge->first.data();
+    }
+
+    static void prefetch(edge_t edge)
+    {
+        __builtin_prefetch(edge->second.get());
+    }
+
+    static node_t head(edge_t edge)
+    {
+        return edge->second.get();
+    }
+};
@@ -0,0 +1,348 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Answers already formatted, by query, bounded to a number of bytes. The
+// cache is split in shards, each behind its own mutex, chosen by the hash of
+// the query.
+//
+// Each shard follows W-TinyLFU: a new answer enters a small LRU window
+// (1% of the shard); the ones leaving it only replace the least recently
+// used answer of the main part if their query was asked more often, as
+// estimated by a count-min sketch of the recent queries. A burst of queries
+// asked once thus never evicts the frequent ones. The main part is a
+// segmented LRU: an answer asked again moves from probation (20%) to the
+// protected segment.
+//
+// The answers depend on the dictionary and on the words added since: they
+// are tagged with a version, and a shard is emptied when it sees a newer
+// one. The answers of an older version, from the queries still running on
+// it, are neither returned nor stored.
+class ResultCache
+{
+public:
+    struct version_t
+    {
+        uint64_t dictionary;
+        uint64_t overlay;
+
+        bool operator==(const version_t& other) const
+        {
+            return dictionary == other.dictionary && overlay == other.overlay;
+        }
+
+        // Whether other is this version or an older one
+        bool covers(const version_t& other) const
+        {
+            return dictionary >= other.dictionary && overlay >= other.overlay;
+        }
+    };
+
+    struct stats_t
+    {
+        uint64_t hits;
+        uint64_t misses;
+        size_t entries;
+        size_t bytes;
+    };
+
+    static const size_t nb_shards = 16;
+    // Memory used by an entry besides its key and answer (list and hash
+    // table nodes)
+    static const size_t entry_overhead = 128;
+
+    explicit ResultCache(size_t capacity)
+      : hits_(0)
+      , misses_(0)
+    {
+        for (auto& s : shards_)
+            s = std::make_unique<shard_t>(capacity / nb_shards);
+    }
+
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+    // Appends the answer of key to out, returns false if it isn't cached
+    bool get(const std::string& key, version_t version, std::string& out)
+    {
+        size_t h = std::hash<std::string>()(key);
+        bool hit = shard_(h).get(key, h, version, out);
+        (hit ? hits_ : misses_).fetch_add(1, std::memory_order_relaxed);
+        return hit;
+    }
+
+    void put(const std::string& key, version_t version,
+             std::string_view value)
+    {
+        size_t h = std::hash<std::string>()(key);
+        shard_(h).put(key, h, version, value);
+    }
+
+    stats_t stats() const
+    {
+        stats_t res{hits_, misses_, 0, 0};
+        for (const auto& s : shards_)
+        {
+            std::lock_guard<std::mutex> lock(s->mutex);
+            res.entries += s->map.size();
+            res.bytes += s->window.bytes + s->probation.bytes +
+                s->protect.bytes;
+        }
+        return res;
+    }
+
+private:
+    // Estimates the number of times a query was asked recently, within 15.
+    // The counters are halved once every 10 queries per counter, so that
+    // the queries that were frequent a while ago are forgotten.
+    class sketch_t
+    {
+    public:
+        explicit sketch_t(size_t nb_entries)
+          : mask_(width_(nb_entries) - 1)
+          , additions_(0)
+          , counters_(depth * (mask_ + 1), 0)
+        {
+        }
+
+        void add(size_t h)
+        {
+            for (size_t i = 0; i < depth; i++)
+            {
+                uint8_t& c = counters_[index_(h, i)];
+                if (c < 15)
+                    c++;
+            }
+            if (++additions_ == 10 * (mask_ + 1))
+            {
+                for (auto& c : counters_)
+                    c /= 2;
+                additions_ /= 2;
+            }
+        }
+
+        unsigned frequency(size_t h) const
+        {
+            unsigned res = 15;
+            for (size_t i = 0; i < depth; i++)
+                res = std::min<unsigned>(res, counters_[index_(h, i)]);
+            return res;
+        }
+
+    private:
+        static const size_t depth = 4;
+
+        static size_t width_(size_t nb_entries)
+        {
+            size_t res = 64;
+            while (res < nb_entries)
+                res *= 2;
+            return res;
+        }
+
+        size_t index_(size_t h, size_t i) const
+        {
+            static const uint64_t seeds[depth] = {
+                0x9e3779b97f4a7c15, 0xc2b2ae3d27d4eb4f,
+                0x165667b19e3779f9, 0x27d4eb2f165667c5,
+            };
+            uint64_t x = (h ^ (h >> 29)) * seeds[i];
+            return i * (mask_ + 1) + ((x >> 32) & mask_);
+        }
+
+        size_t mask_;
+        size_t additions_;
+        std::vector<uint8_t> counters_; // depth rows
+    };
+
+    struct entry_t
+    {
+        std::string key;
+        std::string value;
+        size_t hash;
+        int segment;
+    };
+    using list_t = std::list<entry_t>;
+
+    enum segment_t
+    {
+        in_window,
+        in_probation,
+        in_protected,
+    };
+
+    // Most recently used first
+    struct lru_t
+    {
+        list_t entries;
+        size_t bytes = 0;
+        size_t capacity = 0;
+    };
+
+    struct shard_t
+    {
+        explicit shard_t(size_t capacity)
+          : mutex()
+          , version{0, 0}
+          , window()
+          , probation()
+          , protect()
+          , map()
+          , sketch(capacity / (entry_overhead + 32))
+        {
+            window.capacity = capacity / 100;
+            protect.capacity = (capacity - window.capacity) * 4 / 5;
+            probation.capacity = capacity - window.capacity -
+                protect.capacity;
+        }
+
+        bool get(const std::string& key, size_t h, version_t v,
+                 std::string& out)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            sketch.add(h);
+            if (!use_(v))
+                return false;
+            auto it = map.find(key);
+            if (it == map.end())
+                return false;
+
+            auto e = it->second;
+            out += e->value;
+            if (e->segment != in_window)
+            {
+                move_(e, in_protected);
+                // The protected segment overflows into probation
+                while (protect.bytes > protect.capacity)
+                    move_(std::prev(protect.entries.end()),
+                          in_probation);
+            }
+            else
+                move_(e, in_window);
+            return true;
+        }
+
+        void put(const std::string& key, size_t h, version_t v,
+                 std::string_view value)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            size_t size = key.size() + value.size() + entry_overhead;
+            if (!use_(v) || map.count(key) ||
+                size > std::max(window.capacity, probation.capacity))
+                return;
+
+            window.entries.push_front(entry_t{key, std::string(value), h,
+                                              in_window});
+            window.bytes += size;
+            auto e = window.entries.begin();
+            map.emplace(std::string_view(e->key), e);
+
+            while (window.bytes > window.capacity)
+            {
+                auto candidate = std::prev(window.entries.end());
+                move_(candidate, in_probation);
+                admit_(candidate);
+            }
+        }
+
+        // Whether the answers of v can be used, emptying the shard if v is
+        // newer than its version
+        bool use_(version_t v)
+        {
+            if (v == version)
+                return true;
+            if (!v.covers(version))
+                return false;
+            map.clear();
+            for (auto* l : { &window, &probation, &protect })
+            {
+                l->entries.clear();
+                l->bytes = 0;
+            }
+            version = v;
+            return true;
+        }
+
+        // Makes room in the main part for the candidate coming from the
+        // window: it replaces the least recently used entries while it was
+        // asked more often than them, or is evicted itself
+        void admit_(list_t::iterator candidate)
+        {
+            while (probation.bytes + protect.bytes >
+                   probation.capacity + protect.capacity)
+            {
+                lru_t& from = probation.entries.size() > 1 ||
+                    protect.entries.empty() ? probation : protect;
+                auto victim = std::prev(from.entries.end());
+                if (victim == candidate ||
+                    sketch.frequency(candidate->hash) <=
+                    sketch.frequency(victim->hash))
+                {
+                    erase_(candidate);
+                    return;
+                }
+                erase_(victim);
+            }
+        }
+
+        lru_t& lru_(int segment)
+        {
+            return segment == in_window ? window
+                : segment == in_probation ? probation : protect;
+        }
+
+        static size_t size_(const entry_t& e)
+        {
+            return e.key.size() + e.value.size() + entry_overhead;
+        }
+
+        // Moves e to the front of segment
+        void move_(list_t::iterator e, int segment)
+        {
+            lru_t& from = lru_(e->segment);
+            lru_t& to = lru_(segment);
+            from.bytes -= size_(*e);
+            to.bytes += size_(*e);
+            to.entries.splice(to.entries.begin(), from.entries, e);
+            e->segment = segment;
+        }
+
+        void erase_(list_t::iterator e)
+        {
+            lru_t& from = lru_(e->segment);
+            from.bytes -= size_(*e);
+            map.erase(std::string_view(e->key));
+            from.entries.erase(e);
+        }
+
+        mutable std::mutex mutex;
+        version_t version;
+        lru_t window;
+        lru_t probation;
+        lru_t protect;
+        // The keys are the ones of the entries
+        std::unordered_map<std::string_view, list_t::iterator> map;
+        sketch_t sketch;
+    };
+
+    shard_t& shard_(size_t h)
+    {
+        // The low bits choose the counters of the sketch
+        return *shards_[(h >> 56) % nb_shards];
+    }
+
+    std::array<std::unique_ptr<shard_t>, nb_shards> shards_;
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+};
@@ -0,0 +1,447 @@
+#pragma once
+
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "dictionary-overlay.hh"
+#include "dictionary-watcher.hh"
+#include "query.hh"
+#include "result-cache.hh"
+#include "thread-pool.hh"
+
+// Answers the queries of the clients of a Unix domain socket, one query per
+// line as on the standard input of the app. A client can send many queries
+// without waiting for the answers, which come back in the same order. A line
+// longer than max_line stops the reading of its connection, which is closed
+// once the lines before it are answered.
+//
+// A single thread runs the epoll loop: it reads the queries, hands them by
+// batches to the pool and writes the answers. The workers put the answers
+// of a batch in a completion list and wake the loop up through an eventfd.
+// SIGINT and SIGTERM stop accepting clients and exit once every query
+// received is answered; SIGHUP has the dictionary mapped again.
+//
+// The add and del commands of every client change the same overlay, seen by
+// the queries read after them. The clients also share the cache, if any.
+class QueryServer
+{
+public:
+    // The signals have to be blocked before any thread is started
+    static void block_signals()
+    {
+        sigset_t mask = signals_();
+        pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+    }
+
+    QueryServer(DictionaryWatcher& dicts, OverlayWriter& overlay,
+                const answer_options_t& options, unsigned nb_threads)
+      : dicts_(dicts)
+      , overlay_(overlay)
+      , options_(options)
+      , epoll_(-1)
+      , listen_(-1)
+      , wakeup_(-1)
+      , signals_fd_(-1)
+      , stopping_(false)
+      , next_id_(0)
+      , connections_()
+      , done_mutex_()
+      , done_()
+      , pool_(nb_threads)
+    {
+    }
+
+    ~QueryServer()
+    {
+        for (int fd : { epoll_, listen_, wakeup_, signals_fd_ })
+            if (fd != -1)
+                close(fd);
+    }
+
+    QueryServer(const QueryServer&) = delete;
+    QueryServer& operator=(const QueryServer&) = delete;
+
+    // Returns the exit status of the app
+    int run(const std::string& socket_path)
+    {
+        if (!listen_on_(socket_path))
+            return 1;
+
+        sigset_t mask = signals_();
+        epoll_ = epoll_create1(EPOLL_CLOEXEC);
+        wakeup_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        signals_fd_ = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (epoll_ == -1 || wakeup_ == -1 || signals_fd_ == -1)
+        {
+            std::cerr << "Could not start the event loop: " <<
+                strerror(errno) << std::endl;
+            return 1;
+        }
+        watch_(listen_, EPOLLIN, listen_tag);
+        watch_(wakeup_, EPOLLIN, wakeup_tag);
+        watch_(signals_fd_, EPOLLIN, signals_tag);
+
+        epoll_event events[64];
+        while (!stopping_ || !connections_.empty())
+        {
+            int n = epoll_wait(epoll_, events, 64, -1);
+            if (n < 0 && errno != EINTR)
+                break;
+            for (int i = 0; i < n; i++)
+            {
+                uint64_t tag = events[i].data.u64;
+                if (tag == listen_tag)
+                    accept_();
+                else if (tag == wakeup_tag)
+                    complete_();
+                else if (tag == signals_tag)
+                    signal_();
+                else
+                    handle_(tag, events[i].events);
+            }
+        }
+        unlink(socket_path.c_str());
+        return 0;
+    }
+
+private:
+    // epoll tags of the file descriptors that are not connections
+    static const uint64_t listen_tag = ~uint64_t(0);
+    static const uint64_t wakeup_tag = ~uint64_t(0) - 1;
+    static const uint64_t signals_tag = ~uint64_t(0) - 2;
+
+    // Queries handed to a worker at once
+    static const size_t batch_size = 64;
+    // Batches of a connection being answered before it is read again
+    static const size_t max_pending = 16;
+    // Longest line read: past it, the connection is not read anymore
+    static const size_t max_line = 1 << 16;
+
+    struct connection_t
+    {
+        uint64_t id;
+        int fd;
+        bool read_closed;
+        bool gone;        // the answers can't be written anymore
+        std::string in;   // incomplete line
+        std::string out;  // answers not written yet
+        uint64_t next_batch;
+        uint64_t next_answer;
+        std::map<uint64_t, std::string> answers; // by batch, out of order
+        uint32_t events;  // registered in epoll
+    };
+
+    struct done_t
+    {
+        uint64_t connection;
+        uint64_t batch;
+        std::string answers;
+    };
+
+    static sigset_t signals_()
+    {
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGINT);
+        sigaddset(&mask, SIGTERM);
+        sigaddset(&mask, SIGHUP);
+        sigaddset(&mask, SIGPIPE);
+        return mask;
+    }
+
+    bool listen_on_(const std::string& path)
+    {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof (addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof (addr.sun_path))
+        {
+            std::cerr << "Socket path too long: " << path << std::endl;
+            return false;
+        }
+        memcpy(addr.sun_path, path.c_str(), path.size());
+
+        listen_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                         0);
+        unlink(path.c_str());
+        if (listen_ == -1 ||
+            bind(listen_, reinterpret_cast<sockaddr*>(&addr),
+                 sizeof (addr)) < 0 ||
+            listen(listen_, SOMAXCONN) < 0)
+        {
+            std::cerr << "Could not listen on " << path << ": " <<
+                strerror(errno) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    void watch_(int fd, uint32_t events, uint64_t tag)
+    {
+        epoll_event ev;
+        memset(&ev, 0, sizeof (ev));
+        ev.events = events;
+        ev.data.u64 = tag;
+        epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    void accept_()
+    {
+        int fd;
+        while ((fd = accept4(listen_, nullptr, nullptr,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+        {
+            uint64_t id = next_id_++;
+            connections_[id] = connection_t{id, fd, false, false, "", "",
+                                            0, 0, {}, EPOLLIN};
+            watch_(fd, EPOLLIN, id);
+        }
+    }
+
+    void signal_()
+    {
+        signalfd_siginfo info;
+        while (read(signals_fd_, &info, sizeof (info)) == sizeof (info))
+        {
+            if (info.ssi_signo == SIGHUP)
+                dicts_.reload();
+            else if (info.ssi_signo != SIGPIPE)
+                stop_();
+        }
+    }
+
+    // Stops reading: the queries already read are still answered
+    void stop_()
+    {
+        if (stopping_)
+            return;
+        stopping_ = true;
+        epoll_ctl(epoll_, EPOLL_CTL_DEL, listen_, nullptr);
+        close(listen_);
+        listen_ = -1;
+        std::vector<uint64_t> ids;
+        for (auto& c : connections_)
+            ids.push_back(c.first);
+        for (auto id : ids)
+        {
+            connections_[id].read_closed = true;
+            update_(id);
+        }
+    }
+
+    void handle_(uint64_t id, uint32_t events)
+    {
+        auto it = connections_.find(id);
+        if (it == connections_.end())
+            return;
+        connection_t& c = it->second;
+        if (events & (EPOLLHUP | EPOLLERR))
+        {
+            c.read_closed = true;
+            c.gone = true;
+            c.out.clear();
+        }
+        if (events & EPOLLIN)
+            read_(c);
+        if (events & EPOLLOUT)
+            write_(c);
+        update_(id);
+    }
+
+    void read_(connection_t& c)
+    {
+        char buf[1 << 16];
+        while (!c.read_closed && pending_(c) < max_pending)
+        {
+            ssize_t len = read(c.fd, buf, sizeof (buf));
+            if (len < 0 && errno == EINTR)
+                continue;
+            if (len < 0 && errno == EAGAIN)
+                return;
+            if (len <= 0)
+            {
+                c.read_closed = true;
+                break;
+            }
+            c.in.append(buf, len);
+            dispatch_(c, false);
+            if (c.in.size() > max_line)
+            {
+                // The lines before it are still answered
+                c.in.clear();
+                c.read_closed = true;
+            }
+        }
+        // A last query may not end with a newline
+        dispatch_(c, true);
+    }
+
+    size_t pending_(const connection_t& c) const
+    {
+        return c.next_batch - c.next_answer;
+    }
+
+    // Hands the complete lines of the input to the pool
+    void dispatch_(connection_t& c, bool flush)
+    {
+        std::vector<query_t> batch;
+        size_t begin = 0;
+        size_t end;
+        while ((end = c.in.find('\n', begin)) != std::string::npos ||
+               (flush && c.read_closed && begin < c.in.size()))
+        {
+            if (end == std::string::npos)
+                end = c.in.size();
+            query_t q;
+            bool blank = !parse_query(
+                    std::string_view(c.in).substr(begin, end - begin), q);
+            begin = std::min(end + 1, c.in.size());
+            if (blank)
+                continue;
+            if (q.command != query_t::approx)
+            {
+                if (!batch.empty())
+                    submit_(c, std::move(batch));
+                batch.clear();
+                overlay_.add(q.word, q.command == query_t::add ? q.freq : 0);
+                continue;
+            }
+            batch.push_back(std::move(q));
+            if (batch.size() == batch_size)
+                submit_(c, std::move(batch));
+        }
+        c.in.erase(0, begin);
+        if (!batch.empty())
+            submit_(c, std::move(batch));
+    }
+
+    void submit_(connection_t& c, std::vector<query_t> batch)
+    {
+        uint64_t id = c.id;
+        uint64_t n = c.next_batch++;
+        pool_.submit([this, id, n, dict = dicts_.current(),
+                      words = overlay_.snapshot(),
+                      queries = std::move(batch)]() {
+                static thread_local QueryArena arena;
+                std::string out;
+                for (const auto& q : queries)
+                    answer(out, arena, q, *dict, *words, options_);
+                {
+                    std::lock_guard<std::mutex> lock(done_mutex_);
+                    done_.push_back(done_t{id, n, std::move(out)});
+                }
+                uint64_t one = 1;
+                if (write(wakeup_, &one, sizeof (one)) < 0)
+                    return; // the counter is already set
+        });
+    }
+
+    // Moves the answers of the workers to their connections
+    void complete_()
+    {
+        uint64_t count;
+        if (read(wakeup_, &count, sizeof (count)) < 0)
+            return;
+        std::vector<done_t> done;
+        {
+            std::lock_guard<std::mutex> lock(done_mutex_);
+            done.swap(done_);
+        }
+        for (auto& d : done)
+        {
+            auto it = connections_.find(d.connection);
+            if (it == connections_.end())
+                continue;
+            connection_t& c = it->second;
+            c.answers[d.batch] = std::move(d.answers);
+            for (auto a = c.answers.begin();
+                 a != c.answers.end() && a->first == c.next_answer;
+                 a = c.answers.erase(a))
+            {
+                c.out += a->second;
+                c.next_answer++;
+            }
+            write_(c);
+            update_(d.connection);
+        }
+    }
+
+    void write_(connection_t& c)
+    {
+        if (c.gone)
+            c.out.clear();
+        while (!c.out.empty())
+        {
+            ssize_t len = send(c.fd, c.out.data(), c.out.size(),
+                               MSG_NOSIGNAL);
+            if (len < 0 && errno == EINTR)
+                continue;
+            if (len < 0 && errno == EAGAIN)
+                return;
+            if (len < 0) // the client is gone
+            {
+                c.out.clear();
+                c.read_closed = true;
+                c.gone = true;
+                return;
+            }
+            c.out.erase(0, len);
+        }
+    }
+
+    // Updates the events of the connection, closes it once it is done
+    void update_(uint64_t id)
+    {
+        connection_t& c = connections_[id];
+        if (c.read_closed && !pending_(c) && c.out.empty())
+        {
+            epoll_ctl(epoll_, EPOLL_CTL_DEL, c.fd, nullptr);
+            close(c.fd);
+            connections_.erase(id);
+            return;
+        }
+
+        uint32_t events = 0;
+        if (!c.read_closed && pending_(c) < max_pending)
+            events |= EPOLLIN;
+        if (!c.out.empty())
+            events |= EPOLLOUT;
+        if (events != c.events)
+        {
+            epoll_event ev;
+            memset(&ev, 0, sizeof (ev));
+            ev.events = events;
+            ev.data.u64 = id;
+            epoll_ctl(epoll_, EPOLL_CTL_MOD, c.fd, &ev);
+            c.events = events;
+        }
+    }
+
+    DictionaryWatcher& dicts_;
+    OverlayWriter& overlay_;
+    answer_options_t options_;
+    int epoll_;
+    int listen_;
+    int wakeup_;
+    int signals_fd_;
+    bool stopping_;
+    uint64_t next_id_;
+    std::map<uint64_t, connection_t> connections_;
+    std::mutex done_mutex_;
+    std::vector<done_t> done_; // answers of the workers
+    ThreadPool pool_; // last, so that it is joined first
+};
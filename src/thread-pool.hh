@@ -0,0 +1,60 @@
+#pragma once
+
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "blocking-queue.hh"
+
+// Fixed-size pool of workers running the submitted tasks in FIFO order.
+// The destructor finishes the pending tasks before joining the workers.
+class ThreadPool
+{
+public:
+    using task_t = std::function<void()>;
+
+    ThreadPool(unsigned nb_threads)
+      : tasks_()
+      , workers_()
+    {
+        if (nb_threads == 0)
+            nb_threads = default_size();
+        workers_.reserve(nb_threads);
+        for (unsigned i = 0; i < nb_threads; i++)
+            workers_.emplace_back([this]() {
+                    task_t task;
+                    while (tasks_.pop(task))
+                        task();
+            });
+    }
+
+    ~ThreadPool()
+    {
+        tasks_.close();
+        for (auto& w : workers_)
+            w.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(task_t task)
+    {
+        tasks_.push(std::move(task));
+    }
+
+    size_t size() const
+    {
+        return workers_.size();
+    }
+
+    static unsigned default_size()
+    {
+        unsigned n = std::thread::hardware_concurrency();
+        return n ? n : 1;
+    }
+
+private:
+    BlockingQueue<task_t> tasks_;
+    std::vector<std::thread> workers_;
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <charconv>
+#include <string_view>
+#include <system_error>
+
+// Next token of line after pos, empty at the end of the line
+inline std::string_view next_token(std::string_view line, size_t& pos)
+{
+    auto space = [](char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    };
+    while (pos < line.size() && space(line[pos]))
+        pos++;
+    size_t begin = pos;
+    while (pos < line.size() && !space(line[pos]))
+        pos++;
+    return line.substr(begin, pos - begin);
+}
+
+// Parses a whole token as a number
+template <typename T>
+bool parse_number(std::string_view token, T& n)
+{
+    const char* end = token.data() + token.size();
+    auto res = std::from_chars(token.data(), end, n);
+    return res.ec == std::errc() && res.ptr == end;
+}
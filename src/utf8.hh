@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Decoding of UTF-8, tolerant to invalid input: a byte that does not belong
+// to a valid sequence is a symbol of its own, mapped to a code point no
+// valid sequence gives (a low surrogate), so that it only matches itself.
+struct Utf8
+{
+    // Code point standing for an invalid byte
+    static char32_t raw(unsigned char c)
+    {
+        return 0xdc00 | c;
+    }
+
+    // Length of the sequence starting with lead, 0 if lead can't start one
+    static size_t length(unsigned char lead)
+    {
+        if (lead < 0x80)
+            return 1;
+        if (lead < 0xc2)
+            return 0;
+        if (lead < 0xe0)
+            return 2;
+        if (lead < 0xf0)
+            return 3;
+        return lead < 0xf5 ? 4 : 0;
+    }
+
+    static bool continuation(unsigned char c)
+    {
+        return (c & 0xc0) == 0x80;
+    }
+
+    // Code point of the complete sequence of len bytes at s
+    static char32_t decode(const char* s, size_t len)
+    {
+        static const unsigned char masks[] = { 0, 0x7f, 0x1f, 0x0f, 0x07 };
+        char32_t res = static_cast<unsigned char>(s[0]) & masks[len];
+        for (size_t i = 1; i < len; i++)
+            res = (res << 6) | (static_cast<unsigned char>(s[i]) & 0x3f);
+        return res;
+    }
+
+    // Calls f(c) for each code point of s
+    template <typename Fn>
+    static void for_each(const std::string& s, Fn f)
+    {
+        for (size_t i = 0; i < s.size(); )
+        {
+            size_t len = length(s[i]);
+            size_t n = 1;
+            while (n < len && i + n < s.size() && continuation(s[i + n]))
+                n++;
+            if (len && n == len)
+                f(decode(s.data() + i, len));
+            else
+            {
+                f(raw(s[i]));
+                n = 1;
+            }
+            i += n;
+        }
+    }
+
+    // Appends the code points of s to out
+    static void decode(const std::string& s, std::vector<char32_t>& out)
+    {
+        for_each(s, [&](char32_t c) { out.push_back(c); });
+    }
+
+    // Number of code points of s
+    static size_t size(const std::string& s)
+    {
+        size_t res = 0;
+        for_each(s, [&](char32_t) { res++; });
+        return res;
+    }
+
+    // Decodes the bytes fed one by one: bytes ends with the byte just fed,
+    // after pending bytes of an incomplete character. Calls symbol(c) for
+    // each character it completes, returns the number of bytes of the one
+    // left incomplete.
+    template <typename Fn>
+    static size_t feed(const std::string& bytes, size_t pending, Fn symbol)
+    {
+        size_t end = bytes.size();
+        unsigned char c = bytes[end - 1];
+        if (pending && !continuation(c))
+        {
+            // The bytes before c are a truncated sequence
+            for (size_t i = end - 1 - pending; i < end - 1; i++)
+                symbol(raw(bytes[i]));
+            pending = 0;
+        }
+        size_t begin = end - 1 - pending;
+        size_t len = length(bytes[begin]);
+        if (!len)
+        {
+            symbol(raw(c));
+            return 0;
+        }
+        if (pending + 1 < len)
+            return pending + 1;
+        symbol(decode(bytes.data() + begin, len));
+        return 0;
+    }
+
+    // Appends the UTF-8 encoding of c to out
+    static void encode(char32_t c, std::string& out)
+    {
+        if (c < 0x80)
+            out += static_cast<char>(c);
+        else if (c < 0x800)
+        {
+            out += static_cast<char>(0xc0 | (c >> 6));
+            out += static_cast<char>(0x80 | (c & 0x3f));
+        }
+        else if (c < 0x10000)
+        {
+            out += static_cast<char>(0xe0 | (c >> 12));
+            out += static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+            out += static_cast<char>(0x80 | (c & 0x3f));
+        }
+        else
+        {
+            out += static_cast<char>(0xf0 | (c >> 18));
+            out += static_cast<char>(0x80 | ((c >> 12) & 0x3f));
+            out += static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+            out += static_cast<char>(0x80 | (c & 0x3f));
+        }
+    }
+};
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Pool of workers running tasks which submit more tasks, such as the parts
+// of a split search. Each worker has its own deque: it runs the last task it
+// submitted, whose data is still in its cache, and otherwise steals the
+// oldest task of another deque, usually the biggest. The threads that are
+// not workers submit to a deque of their own, and run tasks too while they
+// wait for theirs (see wait()), so a pool of 0 workers still works.
+class WorkStealingPool
+{
+public:
+    using task_t = std::function<void()>;
+
+    WorkStealingPool(unsigned nb_workers)
+      : queues_(nb_workers + 1)
+      , queued_(0)
+      , stop_(false)
+      , mutex_()
+      , wake_()
+      , workers_()
+    {
+        workers_.reserve(nb_workers);
+        for (unsigned i = 0; i < nb_workers; i++)
+            workers_.emplace_back([this, i]() {
+                    worker_ = worker_t{this, i};
+                    task_t task;
+                    while (true)
+                    {
+                        if (take_(i, task))
+                        {
+                            task();
+                            continue;
+                        }
+                        std::unique_lock<std::mutex> lock(mutex_);
+                        wake_.wait(lock, [this]() {
+                                return stop_ || queued_ > 0;
+                        });
+                        if (stop_ && queued_ == 0)
+                            return;
+                    }
+            });
+    }
+
+    // Finishes the pending tasks before joining the workers
+    ~WorkStealingPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto& w : workers_)
+            w.join();
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    void submit(task_t task)
+    {
+        queue_t& q = queues_[home_()];
+        {
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.tasks.push_back(std::move(task));
+            queued_++;
+        }
+        notify();
+    }
+
+    // Runs tasks until done() holds. Whoever makes it hold calls notify().
+    template <typename Fn>
+    void wait(Fn done)
+    {
+        size_t home = home_();
+        task_t task;
+        while (!done())
+        {
+            if (take_(home, task))
+            {
+                task();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [&]() { return queued_ > 0 || done(); });
+        }
+    }
+
+    void notify()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        wake_.notify_all();
+    }
+
+    size_t size() const
+    {
+        return workers_.size();
+    }
+
+private:
+    struct queue_t
+    {
+        std::mutex mutex;
+        std::deque<task_t> tasks;
+    };
+
+    // The pool and deque of the calling thread, if it is a worker
+    struct worker_t
+    {
+        const WorkStealingPool* pool;
+        size_t index;
+    };
+
+    size_t home_() const
+    {
+        return worker_.pool == this ? worker_.index : workers_.size();
+    }
+
+    // Pops the last task of the deque home, or steals the first one of
+    // another deque
+    bool take_(size_t home, task_t& task)
+    {
+        if (queued_ == 0)
+            return false;
+        for (size_t n = 0; n < queues_.size(); n++)
+        {
+            queue_t& q = queues_[(home + n) % queues_.size()];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (q.tasks.empty())
+                continue;
+            if (n == 0)
+            {
+                task = std::move(q.tasks.back());
+                q.tasks.pop_back();
+            }
+            else
+            {
+                task = std::move(q.tasks.front());
+                q.tasks.pop_front();
+            }
+            queued_--;
+            return true;
+        }
+        return false;
+    }
+
+    static inline thread_local worker_t worker_ = {nullptr, 0};
+
+    std::vector<queue_t> queues_; // one per worker, then the other threads'
+    std::atomic<size_t> queued_;
+    bool stop_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::vector<std::thread> workers_;
+};
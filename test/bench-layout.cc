@@ -0,0 +1,138 @@
+// Compares the node layouts of the compiler: runs the same queries on several
+// compilations of a dictionary, from a cold page cache, and reports the query
+// latencies, the page faults and the last level cache misses.
+//
+//   ./TextMiningCompiler --layout=dfs words.txt dfs.bin
+//   ./TextMiningCompiler --layout=veb words.txt veb.bin
+//   ./bench-layout queries.txt dfs.bin veb.bin
+
+#include "compact-radix-trie.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+struct query_t
+{
+    unsigned max_dist;
+    std::string word;
+};
+
+// Returns -1 if the counter is not available (no PMU, perf_event_paranoid)
+int open_llc_misses()
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof (attr));
+    attr.size = sizeof (attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+void bench(const char* path, const std::vector<query_t>& queries)
+{
+    int fd = -1;
+    if ((fd = open(path, 0)) == -1)
+        abort();
+
+    struct stat s;
+    if (fstat(fd, &s) < 0)
+        abort();
+
+    // Best effort to start from a cold page cache
+    posix_fadvise(fd, 0, s.st_size, POSIX_FADV_DONTNEED);
+
+    void* file = mmap(NULL, s.st_size, PROT_READ, MAP_FILE | MAP_SHARED, fd, 0);
+    if (file == MAP_FAILED)
+        abort();
+    const char* start = reinterpret_cast<const char*>(file);
+
+    int llc = open_llc_misses();
+    struct rusage before;
+    getrusage(RUSAGE_SELF, &before);
+    if (llc != -1)
+        ioctl(llc, PERF_EVENT_IOC_ENABLE, 0);
+
+    std::vector<double> latencies;
+    latencies.reserve(queries.size());
+    for (const auto& q : queries)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        auto res = CompactRadixTrie::matches(q.word, start, q.max_dist);
+        auto t1 = std::chrono::steady_clock::now();
+        latencies.push_back(
+                std::chrono::duration<double, std::micro>(t1 - t0).count());
+    }
+
+    long long misses = -1;
+    if (llc != -1)
+    {
+        ioctl(llc, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(llc, &misses, sizeof (misses)) != sizeof (misses))
+            misses = -1;
+        close(llc);
+    }
+    struct rusage after;
+    getrusage(RUSAGE_SELF, &after);
+
+    munmap(file, s.st_size);
+    close(fd);
+
+    double n = queries.size();
+    double total = 0;
+    for (auto l : latencies)
+        total += l;
+    std::sort(latencies.begin(), latencies.end());
+
+    printf("%-24s %10.1f %10.1f %10.1f %10.2f %10.2f ", path,
+           total / n, latencies[latencies.size() / 2],
+           latencies[latencies.size() * 99 / 100],
+           (after.ru_minflt - before.ru_minflt) / n,
+           (after.ru_majflt - before.ru_majflt) / n);
+    if (misses >= 0)
+        printf("%12.1f\n", misses / n);
+    else
+        printf("%12s\n", "n/a");
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << "Usage: " << argv[0] <<
+            " queries.txt dict.bin [dict.bin...]" << std::endl;
+        return 1;
+    }
+
+    std::ifstream in(argv[1]);
+    std::vector<query_t> queries;
+    std::string approx;
+    query_t q;
+    while (in >> approx >> q.max_dist >> q.word)
+        queries.push_back(q);
+    if (queries.empty())
+    {
+        std::cerr << "No queries in " << argv[1] << std::endl;
+        return 1;
+    }
+
+    printf("%-24s %10s %10s %10s %10s %10s %12s\n", "dictionary",
+           "mean(us)", "p50(us)", "p99(us)", "minflt/q", "majflt/q",
+           "llc-miss/q");
+    for (int i = 2; i < argc; i++)
+        bench(argv[i], queries);
+    return 0;
+}
@@ -1,9 +1,30 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
 #include <limits>
+#include <map>
+#include <random>
+#include <set>
+#include <sstream>
+#include <thread>
 
 #define BOOST_TEST_MODULE distance
 #include <boost/test/included/unit_test.hpp>
 
 #include "damerau-levenshtein.hh"
+#include "damerau-levenshtein-bitparallel.hh"
+#include "damerau-levenshtein-fixed.hh"
+#include "damerau-levenshtein-weighted.hh"
+#include "compact-builder.hh"
+#include "dictionary-overlay.hh"
+#include "dictionary-watcher.hh"
+#include "edit-costs.hh"
+#include "external-sort.hh"
+#include "query-loop.hh"
+#include "query.hh"
+#include "radix-trie.hh"
+#include "result-cache.hh"
+#include "server.hh"
 
 int distance_words(const std::string& a, const std::string& b)
 {
@@ -73,3 +94,1327 @@ BOOST_AUTO_TEST_CASE(TestDistanceRollback)
     dl.feed('n');
     BOOST_CHECK_EQUAL(dl.dist(), 0);
 }
+
+int bp_distance_words(const std::string& a, const std::string& b)
+{
+    BitParallelDamerauLevenshtein dl(a, 10000);
+    for (auto c: b)
+        dl.feed(c);
+    return dl.dist();
+}
+
+#define TEST_WORDS(Word1, Word2, Distance) \
+    BOOST_CHECK_EQUAL(bp_distance_words(Word1, Word2), Distance)
+
+BOOST_AUTO_TEST_CASE(TestBitParallelDistanceWords)
+{
+    TEST_WORDS("azertyuiop", "aeryuop", 3);
+    TEST_WORDS("aeryuop", "azertyuiop", 3);
+    TEST_WORDS("azertyuiopqsdfghjklmwxcvbn,", "qwertyuiopasdfghjkl;zxcvbnm", 6);
+    TEST_WORDS("1234567890", "1324576809", 3);
+    TEST_WORDS(std::string(64, 'a'), std::string(60, 'a') + "baaa", 1);
+}
+
+#undef TEST_WORDS
+
+// Both engines must agree on every feed, including after rollbacks
+BOOST_AUTO_TEST_CASE(TestBitParallelSameAsTable)
+{
+    std::mt19937 rng(42);
+    for (int it = 0; it < 20000; it++)
+    {
+        std::string word;
+        size_t len = 1 + rng() % (it % 10 ? 8 : 64);
+        for (size_t i = 0; i < len; i++)
+            word.push_back('a' + rng() % 3);
+        unsigned max_dist = rng() % 5;
+
+        DamerauLevenshtein dl(word, max_dist);
+        BitParallelDamerauLevenshtein bp(word, max_dist);
+        for (int step = 0; step < 20; step++)
+        {
+            if (rng() % 4 == 0 && !dl.current().empty())
+            {
+                unsigned len = rng() % dl.current().size();
+                dl.rollback(len);
+                bp.rollback(len);
+            }
+            char c = 'a' + rng() % 3;
+            auto r1 = dl.feed(c);
+            auto r2 = bp.feed(c);
+            BOOST_REQUIRE(r1 == r2);
+            if (r1.second)
+                BOOST_REQUIRE_EQUAL(dl.dist(), bp.dist());
+        }
+    }
+}
+
+// On a word of the maximum size, whose band reaches its last bit: the rest
+// of the word is reachable, longer or lacking its characters it is not
+BOOST_AUTO_TEST_CASE(TestBitParallelReachable)
+{
+    std::string word;
+    uint32_t chars = 0;
+    for (int i = 0; i < 64; i++)
+    {
+        word.push_back('a' + i % 26);
+        chars |= uint32_t(1) << (word.back() & 31);
+    }
+    for (unsigned max_dist : { 0, 1, 2 })
+        for (size_t i = 0; i <= word.size(); i++)
+        {
+            BitParallelDamerauLevenshtein dl(word, max_dist);
+            for (size_t k = 0; k < i; k++)
+                dl.feed(word[k]);
+            size_t rest = word.size() - i;
+            BOOST_CHECK(dl.reachable(rest, rest, chars));
+            BOOST_CHECK(!dl.reachable(rest + max_dist + 1, SIZE_MAX, chars));
+            if (rest > 2 * max_dist + 1)
+                BOOST_CHECK(!dl.reachable(rest, rest, 0));
+        }
+}
+
+template <unsigned N>
+void check_fixed_same_as_table(std::mt19937& rng, size_t max_len)
+{
+    for (int it = 0; it < 2000; it++)
+    {
+        std::string word;
+        for (size_t len = 1 + rng() % max_len; len; len--)
+            word.push_back('a' + rng() % 3);
+
+        DamerauLevenshtein dl(word, N);
+        FixedDamerauLevenshtein<N> fixed(word);
+        for (int step = 0; step < 20; step++)
+        {
+            if (rng() % 4 == 0 && !dl.current().empty())
+            {
+                unsigned len = rng() % dl.current().size();
+                dl.rollback(len);
+                fixed.rollback(len);
+            }
+            char c = 'a' + rng() % 3;
+            auto r1 = dl.feed(c);
+            auto r2 = fixed.feed(c);
+            BOOST_REQUIRE(r1 == r2);
+            if (r1.second)
+                BOOST_REQUIRE_EQUAL(dl.dist(), fixed.dist());
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestFixedSameAsTable)
+{
+    std::mt19937 rng(42);
+    for (size_t max_len : { 8, 100 })
+    {
+        check_fixed_same_as_table<0>(rng, max_len);
+        check_fixed_same_as_table<1>(rng, max_len);
+        check_fixed_same_as_table<2>(rng, max_len);
+        check_fixed_same_as_table<3>(rng, max_len);
+        check_fixed_same_as_table<4>(rng, max_len);
+    }
+}
+
+// The vector kernels must give the same rows as the scalar one, on words
+// longer than their blocks and any band
+BOOST_AUTO_TEST_CASE(TestBandKernels)
+{
+    using Band = DamerauLevenshteinBand;
+    std::vector<Band::kernel_t> kernels;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.1"))
+        kernels.push_back(Band::sse41);
+    if (__builtin_cpu_supports("avx2"))
+        kernels.push_back(Band::avx2);
+#endif
+
+    std::mt19937 rng(42);
+    for (int it = 0; it < 3000; it++)
+    {
+        std::string word;
+        size_t len = 1 + rng() % (it % 2 ? 20 : 200);
+        for (size_t i = 0; i < len; i++)
+            word.push_back('a' + rng() % 3);
+        unsigned max_dist = it % 10 ? rng() % 8 : 10000;
+
+        DamerauLevenshtein scalar(word, max_dist, Band::scalar);
+        std::vector<DamerauLevenshtein> dls;
+        for (auto k : kernels)
+            dls.emplace_back(word, max_dist, k);
+        for (int step = 0; step < 2 * int(len) + 10; step++)
+        {
+            if (rng() % 8 == 0 && !scalar.current().empty())
+            {
+                unsigned len = rng() % scalar.current().size();
+                scalar.rollback(len);
+                for (auto& dl : dls)
+                    dl.rollback(len);
+            }
+            char c = 'a' + rng() % 3;
+            auto expected = scalar.feed(c);
+            for (auto& dl : dls)
+            {
+                BOOST_REQUIRE(dl.feed(c) == expected);
+                BOOST_REQUIRE_EQUAL(dl.dist(), scalar.dist());
+            }
+        }
+        // Every cell of the table
+        std::ostringstream expected;
+        expected << scalar;
+        for (const auto& dl : dls)
+        {
+            std::ostringstream table;
+            table << dl;
+            BOOST_REQUIRE(table.str() == expected.str());
+        }
+    }
+}
+
+std::unique_ptr<RadixTrie> make_trie(const std::string& words)
+{
+    std::istringstream in(words);
+    auto trie = std::make_unique<RadixTrie>();
+    trie->load(in);
+    return trie;
+}
+
+std::string compact(const RadixTrie& trie, bool v1 = false,
+                    CompactLayout layout = CompactLayout::dfs)
+{
+    std::ostringstream out;
+    if (v1)
+        trie.serialize_compact_v1(out);
+    else
+        trie.serialize_compact(out, layout);
+    return out.str();
+}
+
+std::string format_matches(const CompactRadixTrie::matches_t& matches)
+{
+    std::ostringstream out;
+    for (const auto& m : matches)
+        out << m.word << ":" << m.freq << ":" << m.distance << " ";
+    return out.str();
+}
+
+BOOST_AUTO_TEST_CASE(TestCompactFormats)
+{
+    std::string long_word(600, 'x');
+    auto trie = make_trie("avion 42\naviateur 13\nconnard 12\ncon 1\n"
+                          "contribuable 1\naviaire 15\n" +
+                          long_word + " 7\n" + long_word.substr(0, 300) +
+                          "y 3");
+    std::string v1 = compact(*trie, true);
+    std::string v2 = compact(*trie);
+
+    BOOST_CHECK_EQUAL(CompactRadixTrie::version(v1.data(), v1.size()), 1);
+    BOOST_CHECK_EQUAL(CompactRadixTrie::version(v2.data(), v2.size()),
+                      unsigned(CompactFormat::version));
+    BOOST_CHECK_EQUAL(CompactRadixTrie::version(v2.data(), v2.size() - 1), 0);
+
+    // The records of the first format have to make up the whole file
+    BOOST_CHECK(CompactRadixTrie::verify(v1.data(), v1.size()));
+    BOOST_CHECK(!CompactRadixTrie::verify(v1.data(), v1.size() - 1));
+    std::string longer = v1 + '\0';
+    BOOST_CHECK(!CompactRadixTrie::verify(longer.data(), longer.size()));
+    std::string garbage(4096, 'x');
+    BOOST_CHECK(!CompactRadixTrie::verify(garbage.data(), garbage.size()));
+    std::string bad_root = v2;
+    CompactFormat::Header header;
+    memcpy(&header, bad_root.data(), sizeof (header));
+    header.root = bad_root.size() - 4;
+    memcpy(&bad_root[0], &header, sizeof (header));
+    BOOST_CHECK_EQUAL(CompactRadixTrie::version(bad_root.data(),
+                                                bad_root.size()), 0);
+
+    const char* queries[] = { "avion", "con", "aviare", "contribuabl" };
+    for (auto q : queries)
+        for (unsigned d = 0; d < 4; d++)
+            BOOST_CHECK_EQUAL(
+                format_matches(CompactRadixTrie::matches(q, v1.data(), d)),
+                format_matches(CompactRadixTrie::matches(q, v2.data(), d)));
+
+    auto m = CompactRadixTrie::matches(long_word.substr(0, 300) + "z",
+                                       v2.data(), 1);
+    BOOST_REQUIRE_EQUAL(m.size(), 1);
+    BOOST_CHECK_EQUAL(m[0].freq, 3);
+    BOOST_CHECK_EQUAL(CompactRadixTrie::matches(long_word, v2.data())[0].freq,
+                      7);
+
+    // Both formats read back as the original trie
+    BOOST_CHECK(compact(*RadixTrie::deserialize_compact(v1.data())) == v2);
+    BOOST_CHECK(compact(*RadixTrie::deserialize_compact(v2.data())) == v2);
+}
+
+BOOST_AUTO_TEST_CASE(TestCompactLayouts)
+{
+    std::string words;
+    std::mt19937 rng(42);
+    for (int i = 0; i < 2000; i++)
+    {
+        std::string word;
+        for (size_t len = 1 + rng() % 10; len; len--)
+            word.push_back('a' + rng() % 4);
+        words += word + " " + std::to_string(1 + rng() % 100) + "\n";
+    }
+    auto trie = make_trie(words);
+    std::string dfs = compact(*trie);
+    std::string bfs = compact(*trie, false, CompactLayout::bfs);
+    std::string veb = compact(*trie, false, CompactLayout::veb);
+    BOOST_CHECK_EQUAL(bfs.size(), dfs.size());
+    BOOST_CHECK_EQUAL(veb.size(), dfs.size());
+
+    const char* queries[] = { "abcd", "ddd", "a", "bacbadcab" };
+    for (auto q : queries)
+        for (unsigned d = 0; d < 3; d++)
+        {
+            auto expected = format_matches(
+                    CompactRadixTrie::matches(q, dfs.data(), d));
+            BOOST_CHECK_EQUAL(expected, format_matches(
+                    CompactRadixTrie::matches(q, bfs.data(), d)));
+            BOOST_CHECK_EQUAL(expected, format_matches(
+                    CompactRadixTrie::matches(q, veb.data(), d)));
+        }
+    BOOST_CHECK(compact(*RadixTrie::deserialize_compact(veb.data())) == dfs);
+}
+
+BOOST_AUTO_TEST_CASE(TestTopMatches)
+{
+    std::string words;
+    std::mt19937 rng(42);
+    for (int i = 0; i < 5000; i++)
+    {
+        std::string word;
+        for (size_t len = 1 + rng() % 8; len; len--)
+            word.push_back('a' + rng() % 4);
+        words += word + " " + std::to_string(1 + rng() % 20) + "\n";
+    }
+    auto trie = make_trie(words);
+    std::string v1 = compact(*trie, true);
+    std::string v2 = compact(*trie);
+
+    // Same as the first k results of a full search, on both formats
+    const char* queries[] = { "abcd", "ddd", "a", "bacbadca" };
+    for (auto q : queries)
+        for (unsigned d = 0; d < 4; d++)
+            for (unsigned k : { 0, 1, 5, 50 })
+            {
+                auto all = CompactRadixTrie::matches(q, v2.data(), d);
+                all.resize(std::min<size_t>(all.size(), k));
+                BOOST_CHECK_EQUAL(format_matches(all), format_matches(
+                        CompactRadixTrie::top_matches(q, v2.data(), k, d)));
+                BOOST_CHECK_EQUAL(format_matches(all), format_matches(
+                        CompactRadixTrie::top_matches(q, v1.data(), k, d)));
+            }
+}
+
+BOOST_AUTO_TEST_CASE(TestLookup)
+{
+    std::string words;
+    std::vector<std::pair<std::string, unsigned>> expected;
+    std::mt19937 rng(42);
+    for (int i = 0; i < 5000; i++)
+    {
+        std::string word;
+        // wide nodes, to go through the vectorized key search
+        for (size_t len = 1 + rng() % 6; len; len--)
+            word.push_back('0' + rng() % 70);
+        unsigned freq = 1 + rng() % 1000;
+        words += word + " " + std::to_string(freq) + "\n";
+        expected.emplace_back(word, freq);
+    }
+    auto trie = make_trie(words);
+    std::string v1 = compact(*trie, true);
+    std::string v2 = compact(*trie);
+
+    // the last frequency of a word wins
+    std::reverse(expected.begin(), expected.end());
+    std::set<std::string> seen;
+    for (const auto& e : expected)
+    {
+        if (!seen.insert(e.first).second)
+            continue;
+        BOOST_CHECK_EQUAL(CompactRadixTrie::lookup(e.first, v1.data()),
+                          e.second);
+        BOOST_CHECK_EQUAL(CompactRadixTrie::lookup(e.first, v2.data()),
+                          e.second);
+        // no word has a '~'
+        BOOST_CHECK_EQUAL(CompactRadixTrie::lookup(e.first + "~", v2.data()),
+                          0);
+    }
+    BOOST_CHECK_EQUAL(CompactRadixTrie::lookup("", v2.data()), 0);
+}
+
+// The nodes of a compact file in depth-first order, with their children in
+// the order of the file whatever its layout
+void format_nodes(std::ostream& out, const CompactFormat::CompactHead* h)
+{
+    out << CompactFormat::freq(h) << " " << CompactFormat::max_freq(h) <<
+        " " << CompactFormat::min_len(h) << " " <<
+        CompactFormat::max_len(h) << " " << CompactFormat::chars(h) << " [";
+    for (size_t c = 0; c < CompactFormat::nb_children(h); ++c)
+    {
+        auto ch = CompactFormat::child(h, c);
+        out.write(CompactFormat::label(ch), CompactFormat::label_len(ch));
+        out << ": ";
+        format_nodes(out, CompactFormat::head(ch));
+    }
+    out << "] ";
+}
+
+std::string format_nodes(const std::string& file)
+{
+    std::ostringstream out;
+    format_nodes(out, CompactFormat::root(file.data()));
+    return out.str();
+}
+
+BOOST_AUTO_TEST_CASE(TestStreamingBuild)
+{
+    std::vector<std::pair<std::string, unsigned>> entries;
+    std::mt19937 rng(42);
+    for (int i = 0; i < 5000; i++)
+    {
+        std::string word;
+        for (size_t len = 1 + rng() % 8; len; len--)
+            word.push_back('a' + rng() % 4);
+        entries.emplace_back(word, 1 + rng() % 100);
+    }
+    entries.emplace_back(std::string(600, 'b'), 3);
+    entries.emplace_back(std::string(300, 'b') + "a", 5);
+
+    std::string words;
+    for (const auto& e : entries)
+        words += e.first + " " + std::to_string(e.second) + "\n";
+    std::string expected = compact(*make_trie(words));
+
+    // Small enough to spill several runs
+    ExternalSorter sorter(4096);
+    for (const auto& e : entries)
+        BOOST_REQUIRE(sorter.add(e.first, e.second));
+
+    std::ostringstream out;
+    CompactBuilder builder(out);
+    std::string last;
+    BOOST_REQUIRE(sorter.merge([&](const std::string& w, unsigned f) {
+            BOOST_REQUIRE(last <= w);
+            last = w;
+            BOOST_REQUIRE(builder.add(w, f));
+    }));
+    BOOST_REQUIRE(builder.finish());
+
+    std::string streamed = out.str();
+    BOOST_CHECK_EQUAL(CompactRadixTrie::version(streamed.data(),
+                                                streamed.size()),
+                      unsigned(CompactFormat::version));
+    // Written in another order, the root last, but with the same nodes
+    BOOST_CHECK_EQUAL(streamed.size(), expected.size());
+    BOOST_CHECK(format_nodes(streamed) == format_nodes(expected));
+
+    // The children of the root are sorted for the top-k search too
+    std::ostringstream top_out;
+    CompactBuilder top(top_out);
+    BOOST_CHECK(top.add("bb", 5) && top.add("cc", 1) && top.add("dd", 6));
+    BOOST_REQUIRE(top.finish());
+    BOOST_CHECK_EQUAL(format_matches(CompactRadixTrie::top_matches(
+                              "xx", top_out.str().data(), 1, 2)),
+                      "dd:6:2 ");
+
+    // An unsorted word fails the rest of the build
+    std::ostringstream unsorted_out;
+    CompactBuilder unsorted(unsorted_out);
+    BOOST_CHECK(unsorted.add("b", 1));
+    BOOST_CHECK(!unsorted.add("a", 1));
+    BOOST_CHECK_EQUAL(unsorted.error(), "Words are not sorted: a");
+    BOOST_CHECK(!unsorted.add("c", 1));
+    BOOST_CHECK(!unsorted.finish());
+}
+
+BOOST_AUTO_TEST_CASE(TestDawg)
+{
+    const char* stems[] = { "parl", "mang", "chant", "aim", "donn", "tomb" };
+    const char* suffixes[] = { "er", "e", "es", "ons", "ez", "ent", "ais",
+                               "ait", "aient", "ement", "ation", "ations" };
+    std::string words;
+    unsigned freq = 1;
+    for (auto st : stems)
+        for (auto su : suffixes)
+            words += std::string(st) + su + " " + std::to_string(freq++) +
+                "\n";
+    std::string long_word(600, 'x');
+    words += long_word + " 7\n" + long_word.substr(0, 300) + "y 3\n"
+        "\xc3\xa9t\xc3\xa9 5\nete 4";
+    auto trie = make_trie(words);
+
+    std::string trie_bin = compact(*trie);
+    std::ostringstream out;
+    trie->serialize_dawg(out);
+    std::string dawg_bin = out.str();
+
+    BOOST_CHECK_EQUAL(CompactRadixTrie::version(dawg_bin.data(),
+                                                dawg_bin.size()),
+                      unsigned(CompactDawgFormat::version));
+    BOOST_CHECK_EQUAL(CompactRadixTrie::version(dawg_bin.data(),
+                                                dawg_bin.size() - 1), 0);
+    // The suffixes are shared by the stems
+    BOOST_CHECK_LT(dawg_bin.size() * 3, trie_bin.size() * 2);
+
+    const char* queries[] = { "parlait", "mangeons", "chantation", "aimer",
+                              "tombaient", "\xc3\xa9t\xc3\xa9", "xx" };
+    for (auto q : queries)
+        for (unsigned d = 0; d < 4; d++)
+        {
+            BOOST_CHECK_EQUAL(
+                format_matches(CompactRadixTrie::matches(q, trie_bin.data(),
+                                                         d)),
+                format_matches(CompactRadixTrie::matches(q, dawg_bin.data(),
+                                                         d)));
+            BOOST_CHECK_EQUAL(
+                format_matches(CompactRadixTrie::top_matches(
+                        q, trie_bin.data(), 3, d)),
+                format_matches(CompactRadixTrie::top_matches(
+                        q, dawg_bin.data(), 3, d)));
+        }
+    BOOST_CHECK_EQUAL(CompactRadixTrie::lookup(long_word, dawg_bin.data()), 7);
+    BOOST_CHECK_EQUAL(CompactRadixTrie::lookup("donnez", dawg_bin.data()),
+                      CompactRadixTrie::lookup("donnez", trie_bin.data()));
+    BOOST_CHECK_EQUAL(CompactRadixTrie::lookup("donn", dawg_bin.data()), 0);
+
+    BOOST_CHECK(compact(*RadixTrie::deserialize_compact(dawg_bin.data())) ==
+                trie_bin);
+}
+
+BOOST_AUTO_TEST_CASE(TestDeleteIndex)
+{
+    std::string words;
+    std::mt19937 rng(42);
+    for (int i = 0; i < 3000; i++)
+    {
+        std::string word;
+        for (size_t len = 1 + rng() % 9; len; len--)
+            word.push_back('a' + rng() % 5);
+        words += word + " " + std::to_string(1 + rng() % 100) + "\n";
+    }
+    words += std::string(80, 'c') + " 4";
+    auto trie = make_trie(words);
+    std::string plain = compact(*trie);
+
+    for (size_t prefix : { 0, 3 })
+    {
+        std::ostringstream out;
+        trie->serialize_compact(out, CompactLayout::dfs, 2, prefix);
+        std::string indexed = out.str();
+        BOOST_REQUIRE_EQUAL(CompactRadixTrie::version(indexed.data(),
+                                                      indexed.size()),
+                            unsigned(CompactFormat::version));
+
+        for (int i = 0; i < 200; i++)
+        {
+            std::string q;
+            for (size_t len = 1 + rng() % 10; len; len--)
+                q.push_back('a' + rng() % 6);
+            if (i == 0)
+                q = std::string(79, 'c') + "d";
+            for (unsigned d = 1; d <= 3; d++)
+            {
+                BOOST_CHECK_EQUAL(
+                    format_matches(CompactRadixTrie::matches(q, plain.data(),
+                                                             d)),
+                    format_matches(CompactRadixTrie::matches(
+                            q, indexed.data(), d)));
+                BOOST_CHECK_EQUAL(
+                    format_matches(CompactRadixTrie::top_matches(
+                            q, plain.data(), 5, d)),
+                    format_matches(CompactRadixTrie::top_matches(
+                            q, indexed.data(), 5, d)));
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestChecksum)
+{
+    auto trie = make_trie("avion 42\naviateur 13\nconnard 12\ncon 1");
+    std::ostringstream dawg_out;
+    trie->serialize_dawg(dawg_out);
+    std::ostringstream streamed_out;
+    CompactBuilder builder(streamed_out);
+    for (auto w : { "aviateur", "avion", "con", "connard" })
+        builder.add(w, 1);
+    BOOST_REQUIRE(builder.finish());
+
+    for (std::string bin : { compact(*trie), dawg_out.str(),
+                             streamed_out.str() })
+    {
+        BOOST_CHECK(CompactRadixTrie::verify(bin.data(), bin.size()));
+        bin[bin.size() - 5] ^= 1;
+        BOOST_CHECK(!CompactRadixTrie::verify(bin.data(), bin.size()));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestDictionaryReload)
+{
+    std::string path = "unit-reload.bin";
+    auto write = [&](const std::string& words, bool valid = true) {
+        std::ofstream out(path + ".tmp");
+        if (valid)
+            make_trie(words)->serialize_compact(out);
+        else
+            out << words;
+        out.close();
+        std::rename((path + ".tmp").c_str(), path.c_str());
+    };
+    auto wait_generation = [](const DictionaryWatcher& dicts, unsigned g) {
+        for (int i = 0; i < 500 && dicts.generation() < g; i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        return dicts.generation() == g;
+    };
+
+    write("avion 42");
+    std::string error;
+    auto first = Dictionary::open(path, error);
+    BOOST_REQUIRE(first);
+    DictionaryWatcher dicts(path, first, true);
+    first.reset();
+    auto held = dicts.current();
+
+    // Replaced by a rename
+    write("avion 7");
+    BOOST_REQUIRE(wait_generation(dicts, 1));
+    BOOST_CHECK_EQUAL(CompactRadixTrie::lookup("avion",
+                                               dicts.current()->start()), 7);
+    // The previous one is still mapped for the queries using it
+    BOOST_CHECK_EQUAL(CompactRadixTrie::lookup("avion", held->start()), 42);
+
+    // Invalid files are ignored
+    write("garbage", false);
+    dicts.reload();
+    write(std::string(4096, 'x'), false);
+    dicts.reload();
+    write(compact(*make_trie("avion 5")).substr(0, 40), false);
+    dicts.reload();
+    write("avion 3");
+    BOOST_REQUIRE(wait_generation(dicts, 2));
+    BOOST_CHECK_EQUAL(CompactRadixTrie::lookup("avion",
+                                               dicts.current()->start()), 3);
+    std::remove(path.c_str());
+}
+
+std::string format_arena(const QueryArena& arena)
+{
+    std::ostringstream out;
+    for (const auto& m : arena.matches())
+        out << arena.word(m) << ":" << m.freq << ":" << m.distance << " ";
+    return out.str();
+}
+
+BOOST_AUTO_TEST_CASE(TestOverlay)
+{
+    std::map<std::string, unsigned> words;
+    std::mt19937 rng(42);
+    auto random_word = [&]() {
+        std::string word;
+        for (size_t len = 1 + rng() % 8; len; len--)
+            word.push_back('a' + rng() % 4);
+        return word;
+    };
+    for (int i = 0; i < 3000; i++)
+        words[random_word()] = 1 + rng() % 20;
+    auto to_text = [](const std::map<std::string, unsigned>& ws) {
+        std::string res;
+        for (const auto& w : ws)
+            res += w.first + " " + std::to_string(w.second) + "\n";
+        return res;
+    };
+    auto trie = make_trie(to_text(words));
+    std::string base = compact(*trie);
+
+    // Added, replaced and deleted words
+    DictionaryOverlay overlay;
+    for (int i = 0; i < 300; i++)
+    {
+        std::string word = random_word();
+        unsigned freq = rng() % 3 ? 1 + rng() % 20 : 0;
+        overlay.add(word, freq);
+        if (freq)
+        {
+            words[word] = freq;
+            trie->add_word(freq, word);
+        }
+        else
+        {
+            words.erase(word);
+            trie->remove_word(word);
+        }
+    }
+    // Same as a dictionary compiled with the changes
+    std::string merged = compact(*make_trie(to_text(words)));
+    BOOST_CHECK(compact(*trie) == merged);
+
+    QueryArena arena;
+    const char* queries[] = { "abcd", "ddd", "a", "bacbadca" };
+    for (auto q : queries)
+        for (unsigned d = 0; d < 3; d++)
+        {
+            BOOST_CHECK_EQUAL(
+                format_matches(CompactRadixTrie::matches(q, merged.data(), d)),
+                (CompactRadixTrie::matches(arena, q, base.data(), d, overlay),
+                 format_arena(arena)));
+            BOOST_CHECK_EQUAL(
+                format_matches(CompactRadixTrie::top_matches(
+                        q, merged.data(), 5, d)),
+                (CompactRadixTrie::top_matches(arena, q, base.data(), 5, d,
+                                               overlay),
+                 format_arena(arena)));
+        }
+}
+
+// A snapshot taken after each command keeps its words, and few segments
+BOOST_AUTO_TEST_CASE(TestOverlaySnapshots)
+{
+    std::mt19937 rng(42);
+    OverlayWriter writer;
+    std::map<std::string, unsigned> words;
+    std::vector<std::shared_ptr<const DictionaryOverlay>> snapshots;
+    std::vector<std::map<std::string, unsigned>> expected;
+    for (int i = 0; i < 2000; i++)
+    {
+        std::string word(1 + rng() % 3, 'a' + rng() % 4);
+        unsigned freq = rng() % 4 ? 1 + rng() % 20 : 0;
+        writer.add(word, freq);
+        words[word] = freq;
+        snapshots.push_back(writer.snapshot());
+        expected.push_back(words);
+        BOOST_CHECK_LE(size_t(1) << snapshots.back()->nb_segments(),
+                       2 * size_t(i + 1));
+    }
+    for (size_t i = 0; i < snapshots.size(); i += 97)
+        for (const auto& w : words)
+        {
+            unsigned freq = 42;
+            auto it = expected[i].find(w.first);
+            BOOST_CHECK_EQUAL(snapshots[i]->find(w.first, freq),
+                              it != expected[i].end());
+            if (it != expected[i].end())
+                BOOST_CHECK_EQUAL(freq, it->second);
+        }
+}
+
+BOOST_AUTO_TEST_CASE(TestBatchMatches)
+{
+    std::string words;
+    std::mt19937 rng(42);
+    auto random_word = [&](size_t max_len) {
+        std::string word;
+        for (size_t len = 1 + rng() % max_len; len; len--)
+            word.push_back('a' + rng() % 5);
+        return word;
+    };
+    for (int i = 0; i < 3000; i++)
+        words += random_word(9) + " " + std::to_string(1 + rng() % 100) +
+            "\n";
+    words += std::string(70, 'c') + " 4";
+    auto trie = make_trie(words);
+    std::ostringstream dawg_out;
+    trie->serialize_dawg(dawg_out);
+    std::ostringstream indexed_out;
+    trie->serialize_compact(indexed_out, CompactLayout::dfs, 1);
+
+    // More queries than a group, sharing prefixes, at mixed distances
+    std::vector<std::string> queries;
+    for (int i = 0; i < 100; i++)
+        queries.push_back(random_word(10));
+    queries.push_back(std::string(69, 'c') + "d");
+    queries.push_back(queries[0]);
+
+    for (std::string bin : { compact(*trie), dawg_out.str(),
+                             indexed_out.str() })
+    {
+        std::vector<QueryArena> arenas(queries.size());
+        std::vector<CompactRadixTrie::batch_query_t> batch;
+        for (size_t i = 0; i < queries.size(); i++)
+            batch.push_back({&arenas[i], &queries[i], unsigned(i % 4)});
+        CompactRadixTrie::batch_matches(batch, bin.data());
+        for (size_t i = 0; i < queries.size(); i++)
+            BOOST_CHECK_EQUAL(
+                format_matches(CompactRadixTrie::matches(queries[i],
+                                                         bin.data(), i % 4)),
+                format_arena(arenas[i]));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestParallelMatches)
+{
+    std::string words;
+    std::mt19937 rng(42);
+    auto random_word = [&](size_t max_len) {
+        std::string word;
+        for (size_t len = 1 + rng() % max_len; len; len--)
+            word.push_back('a' + rng() % 5);
+        return word;
+    };
+    for (int i = 0; i < 3000; i++)
+        words += random_word(9) + " " + std::to_string(1 + rng() % 100) +
+            "\n";
+    auto trie = make_trie(words);
+    std::ostringstream dawg_out;
+    trie->serialize_dawg(dawg_out);
+    DictionaryOverlay overlay;
+    for (int i = 0; i < 100; i++)
+        overlay.add(random_word(9), rng() % 2 ? 1 + rng() % 100 : 0);
+
+    // Split every few nodes, the same matches through the same nodes
+    WorkStealingPool pool(3);
+    QueryArena arena;
+    QueryArena split;
+    for (std::string bin : { compact(*trie), dawg_out.str() })
+        for (int i = 0; i < 20; i++)
+        {
+            std::string q = random_word(5);
+            unsigned d = 1 + i % 5;
+            arena.stats() = split.stats() = QueryArena::stats_t{0, 0};
+            CompactRadixTrie::matches(arena, q, bin.data(), d);
+            CompactRadixTrie::parallel_matches(split, q, bin.data(), d,
+                    CompactRadixTrie::no_overlay_t(), pool, 20);
+            BOOST_CHECK_EQUAL(format_arena(split), format_arena(arena));
+            BOOST_CHECK_EQUAL(split.stats().nodes, arena.stats().nodes);
+
+            CompactRadixTrie::matches(arena, q, bin.data(), d, overlay);
+            CompactRadixTrie::parallel_matches(split, q, bin.data(), d,
+                                               overlay, pool, 20);
+            BOOST_CHECK_EQUAL(format_arena(split), format_arena(arena));
+        }
+}
+
+BOOST_AUTO_TEST_CASE(TestSubtreeBounds)
+{
+    std::string words;
+    std::mt19937 rng(42);
+    auto random_word = [&](size_t max_len) {
+        std::string word;
+        for (size_t len = 1 + rng() % max_len; len; len--)
+            word.push_back('a' + rng() % 26);
+        return word;
+    };
+    for (int i = 0; i < 3000; i++)
+        words += random_word(rng() % 2 ? 4 : 16) + " " +
+            std::to_string(1 + rng() % 100) + "\n";
+    words += std::string(300, 'x') + "yz 2\n" + std::string(70, 'c') + " 4";
+    auto trie = make_trie(words);
+    std::string v1 = compact(*trie, true);
+    std::string v2 = compact(*trie);
+    BOOST_CHECK_LT(v2.size(), v1.size());
+
+    // The same matches as without bounds, through fewer nodes
+    std::vector<std::string> queries;
+    for (int i = 0; i < 100; i++)
+        queries.push_back(random_word(16));
+    queries.push_back(std::string(300, 'x') + "zy");
+    queries.push_back(std::string(69, 'c') + "d");
+    QueryArena unbounded;
+    QueryArena bounded;
+    for (const auto& q : queries)
+        for (unsigned d = 0; d < 4; d++)
+        {
+            CompactRadixTrie::matches(unbounded, q, v1.data(), d);
+            CompactRadixTrie::matches(bounded, q, v2.data(), d);
+            BOOST_CHECK_EQUAL(format_arena(bounded), format_arena(unbounded));
+        }
+    BOOST_CHECK_LT(2 * bounded.stats().nodes, unbounded.stats().nodes);
+}
+
+BOOST_AUTO_TEST_CASE(TestResultCache)
+{
+    ResultCache cache(64 << 10);
+    ResultCache::version_t v{1, 1};
+    std::string out;
+    BOOST_CHECK(!cache.get("avion", v, out));
+    cache.put("avion", v, "[42]");
+    BOOST_CHECK(cache.get("avion", v, out));
+    BOOST_CHECK_EQUAL(out, "[42]");
+
+    // Frequent queries are kept through a scan of queries asked once
+    std::string answer(200, 'x');
+    for (int round = 0; round < 5; round++)
+        for (int i = 0; i < 20; i++)
+        {
+            std::string key = "hot" + std::to_string(i);
+            if (!cache.get(key, v, out))
+                cache.put(key, v, answer);
+        }
+    for (int i = 0; i < 20000; i++)
+    {
+        std::string key = "cold" + std::to_string(i);
+        if (!cache.get(key, v, out))
+            cache.put(key, v, answer);
+    }
+    int kept = 0;
+    for (int i = 0; i < 20; i++)
+        kept += cache.get("hot" + std::to_string(i), v, out);
+    BOOST_CHECK_GE(kept, 18);
+    BOOST_CHECK_LE(cache.stats().bytes, size_t(64 << 10));
+
+    // A newer version empties the cache, an older one doesn't use it
+    ResultCache::version_t newer{1, 2};
+    BOOST_CHECK(!cache.get("hot0", newer, out));
+    cache.put("hot0", newer, "[7]");
+    out.clear();
+    BOOST_CHECK(cache.get("hot0", newer, out));
+    BOOST_CHECK_EQUAL(out, "[7]");
+    BOOST_CHECK(!cache.get("hot0", v, out));
+    cache.put("hot1", v, "[3]");
+    BOOST_CHECK(!cache.get("hot1", newer, out));
+}
+
+BOOST_AUTO_TEST_CASE(TestParseQuery)
+{
+    query_t q;
+    BOOST_CHECK(!parse_query(" \t\r", q));
+    BOOST_CHECK(parse_query("approx 2 avion\r", q));
+    BOOST_CHECK_EQUAL(q.max_dist, 2);
+    BOOST_CHECK_EQUAL(q.word, "avion");
+    BOOST_CHECK(parse_query("  approx-top 3\t1 avion", q));
+    BOOST_CHECK_EQUAL(q.top, 3);
+    BOOST_CHECK_EQUAL(q.max_dist, 1);
+    BOOST_CHECK(parse_query("add avion 42", q));
+    BOOST_CHECK_EQUAL(q.command, query_t::add);
+    BOOST_CHECK_EQUAL(q.freq, 42u);
+
+    // Malformed queries have an empty answer
+    for (auto line : { "approx", "approx 1", "approx x avion",
+                       "approx 1x avion", "approx -1 avion", "foo 1 avion",
+                       "approx-top -1 1 avion", "approx 9999999999 avion",
+                       "add avion" })
+    {
+        BOOST_CHECK(parse_query(line, q));
+        BOOST_CHECK_EQUAL(q.command, query_t::approx);
+        BOOST_CHECK_LT(q.max_dist, 0);
+    }
+}
+
+// Runs a loop of the app on the input, read from a file or from a pipe
+template <typename Fn>
+std::string run_loop(const std::string& input, bool pipe_input, Fn run)
+{
+    std::string in_path = "unit-loop.in";
+    std::string out_path = "unit-loop.out";
+    int out_fd = open(out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int in_fd;
+    std::thread writer;
+    if (pipe_input)
+    {
+        int fds[2];
+        BOOST_REQUIRE(pipe(fds) == 0);
+        in_fd = fds[0];
+        // In pieces, so that the loop sees partial input
+        writer = std::thread([&input, fd = fds[1]]() {
+            for (size_t pos = 0; pos < input.size(); pos += 1000)
+                if (write(fd, input.data() + pos,
+                          std::min<size_t>(1000, input.size() - pos)) < 0)
+                    break;
+            close(fd);
+        });
+    }
+    else
+    {
+        std::ofstream(in_path) << input;
+        in_fd = open(in_path.c_str(), O_RDONLY);
+    }
+    {
+        LineReader in(in_fd);
+        OutputBuffer out(out_fd, 4096);
+        run(in, out);
+    }
+    if (writer.joinable())
+        writer.join();
+    close(in_fd);
+    close(out_fd);
+    std::ifstream f(out_path);
+    std::stringstream res;
+    res << f.rdbuf();
+    std::remove(in_path.c_str());
+    std::remove(out_path.c_str());
+    return res.str();
+}
+
+// The answers of the threads are in input order, and each batch sees the
+// add and del commands read before it only
+BOOST_AUTO_TEST_CASE(TestRunParallel)
+{
+    std::mt19937 rng(42);
+    auto random_word = [&]() {
+        std::string word;
+        for (size_t len = 1 + rng() % 6; len; len--)
+            word.push_back('a' + rng() % 4);
+        return word;
+    };
+    std::string words;
+    for (int i = 0; i < 1000; i++)
+        words += random_word() + " " + std::to_string(1 + rng() % 100) + "\n";
+    std::string path = "unit-loop.bin";
+    {
+        std::ofstream out(path);
+        make_trie(words)->serialize_compact(out);
+    }
+    std::string error;
+    auto dict = Dictionary::open(path, error);
+    BOOST_REQUIRE(dict);
+    DictionaryWatcher dicts(path, dict, false);
+
+    // Runs of queries, some longer than a batch, between runs of commands
+    std::string input;
+    for (int run = 0; run < 60; run++)
+    {
+        for (size_t n = rng() % 3 ? rng() % 4 : 0; n; n--)
+            input += rng() % 3 ? "add " + random_word() + " " +
+                std::to_string(rng() % 100) + "\n"
+                : "del " + random_word() + "\n";
+        for (size_t n = rng() % 2 ? rng() % 10 : rng() % 200; n; n--)
+            input += rng() % 4 ? "approx " + std::to_string(rng() % 3) + " " +
+                random_word() + "\n"
+                : "approx-top 3 2 " + random_word() + "\n";
+    }
+
+    answer_options_t options;
+    for (bool batch_search : { false, true })
+    {
+        OverlayWriter overlay;
+        std::string expected = run_loop(input, false, [&](auto& in,
+                                                          auto& out) {
+            run_sequential(in, out, dicts, overlay, options, batch_search);
+        });
+        BOOST_REQUIRE(!expected.empty());
+        for (bool pipe_input : { false, true })
+            for (unsigned nb_threads : { 2, 4 })
+            {
+                OverlayWriter overlay;
+                BOOST_CHECK(run_loop(input, pipe_input, [&](auto& in,
+                                                            auto& out) {
+                    run_parallel(in, out, dicts, overlay, options, nb_threads,
+                                 batch_search);
+                }) == expected);
+            }
+    }
+    std::remove(path.c_str());
+}
+
+int connect_to(const std::string& path)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    // The server may not listen yet
+    for (int i = 0; i < 500 && connect(fd, reinterpret_cast<sockaddr*>(&addr),
+                                       sizeof (addr)) < 0; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    // Fails rather than hangs if an answer is missing
+    timeval timeout = {10, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout));
+    return fd;
+}
+
+// Sends the queries at once, returns the answers until the server closes
+std::string exchange(int fd, const std::string& queries, bool close_write)
+{
+    for (size_t sent = 0; sent < queries.size(); )
+    {
+        ssize_t len = send(fd, queries.data() + sent, queries.size() - sent,
+                           MSG_NOSIGNAL);
+        if (len <= 0)
+            break; // closed by the server
+        sent += len;
+    }
+    if (close_write)
+        shutdown(fd, SHUT_WR);
+    std::string res;
+    char buf[4096];
+    ssize_t len;
+    while ((len = read(fd, buf, sizeof (buf))) > 0)
+        res.append(buf, len);
+    if (len < 0 && errno == EAGAIN)
+        res += "(not closed)";
+    close(fd);
+    return res;
+}
+
+BOOST_AUTO_TEST_CASE(TestServer)
+{
+    std::string path = "unit-server.bin";
+    std::string socket_path = "unit-server.sock";
+    {
+        std::ofstream out(path);
+        make_trie("avion 42\nballon 5\n")->serialize_compact(out);
+    }
+    std::string error;
+    auto dict = Dictionary::open(path, error);
+    BOOST_REQUIRE(dict);
+
+    // Blocked before the threads of the server start, as in the app
+    sigset_t mask;
+    pthread_sigmask(SIG_SETMASK, nullptr, &mask);
+    QueryServer::block_signals();
+    {
+        DictionaryWatcher dicts(path, dict, false);
+        OverlayWriter overlay;
+        QueryServer server(dicts, overlay, answer_options_t(), 2);
+        int res = 1;
+        std::thread thread([&]() { res = server.run(socket_path); });
+
+        // Pipelined over many batches, add and del apply to the next lines
+        std::string avion =
+            "[{\"word\":\"avion\",\"freq\":42,\"distance\":0}]\n";
+        std::string queries;
+        std::string expected;
+        for (int i = 0; i < 300; i++)
+        {
+            queries += "approx 0 avion\n";
+            expected += avion;
+            if (i % 100 == 50)
+            {
+                queries += "approx 1 zebre\n";
+                expected += "[]\n";
+            }
+        }
+        queries += "add zebre 3\napprox 0 zebre\ndel avion\napprox 0 avion\n"
+            "approx 0 ballon";
+        expected += "[{\"word\":\"zebre\",\"freq\":3,\"distance\":0}]\n[]\n"
+            "[{\"word\":\"ballon\",\"freq\":5,\"distance\":0}]\n";
+        BOOST_CHECK_EQUAL(exchange(connect_to(socket_path), queries, true),
+                          expected);
+
+        // The changes are seen by the other clients. A line too long closes
+        // the connection once the lines before it are answered.
+        queries = "approx 0 zebre\napprox 0 " + std::string(1 << 20, 'a');
+        expected = "[{\"word\":\"zebre\",\"freq\":3,\"distance\":0}]\n";
+        BOOST_CHECK_EQUAL(exchange(connect_to(socket_path), queries, false),
+                          expected);
+
+        pthread_kill(thread.native_handle(), SIGTERM);
+        thread.join();
+        BOOST_CHECK_EQUAL(res, 0);
+    }
+    pthread_sigmask(SIG_SETMASK, &mask, nullptr);
+    std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(TestParallelBuild)
+{
+    std::string words;
+    std::mt19937 rng(42);
+    const char first[] = "abcz\xc3";
+    for (int i = 0; i < 5000; i++)
+    {
+        std::string word(1, first[rng() % 5]);
+        for (size_t len = rng() % 8; len; len--)
+            word.push_back('a' + rng() % 4);
+        // Some words are given again with another frequency
+        words += word + " " + std::to_string(1 + rng() % 100) +
+            (i % 3 ? "\n" : " \r\n");
+    }
+    words += std::string(600, 'x') + " 7\n" + std::string(300, 'x') + "y 3";
+    auto expected = make_trie(words);
+
+    for (unsigned nb_threads : { 1, 3, 8 })
+    {
+        std::string error;
+        auto trie = RadixTrie::load(words, nb_threads, error);
+        BOOST_REQUIRE(trie);
+        for (auto layout : { CompactLayout::dfs, CompactLayout::bfs,
+                             CompactLayout::veb })
+        {
+            std::ostringstream out;
+            trie->serialize_compact(out, layout, 0, 0, nb_threads);
+            BOOST_CHECK(out.str() == compact(*expected, false, layout));
+        }
+        std::ostringstream indexed;
+        trie->serialize_compact(indexed, CompactLayout::dfs, 2, 0,
+                                nb_threads);
+        std::ostringstream expected_indexed;
+        expected->serialize_compact(expected_indexed, CompactLayout::dfs, 2);
+        BOOST_CHECK(indexed.str() == expected_indexed.str());
+    }
+
+    // Small inputs and lines longer than the chunks, on many threads
+    std::vector<std::string> inputs = { "", "abc 1", "abc 1\nbcd 2\ncde 3\n",
+                                        "\n\nabc 1\n\n" };
+    for (size_t max_len : { 10, 3000, 20000 })
+        for (int i = 0; i < 5; i++)
+        {
+            std::string text;
+            for (size_t size = rng() % 100000; text.size() < size; )
+                text += std::string(1 + rng() % max_len, 'a' + rng() % 5) +
+                    " " + std::to_string(1 + rng() % 100) + "\n";
+            inputs.push_back(text);
+        }
+    for (const auto& input : inputs)
+    {
+        std::string error;
+        auto expected = RadixTrie::load(input, 1, error);
+        BOOST_REQUIRE(expected);
+        for (unsigned nb_threads : { 2, 3, 8, 16 })
+        {
+            auto trie = RadixTrie::load(input, nb_threads, error);
+            BOOST_REQUIRE(trie);
+            BOOST_CHECK(compact(*trie) == compact(*expected));
+        }
+    }
+
+    std::string error;
+    BOOST_CHECK(!RadixTrie::load("avion 42\nvoiture\n", 2, error));
+    BOOST_CHECK(!RadixTrie::load("avion 42 13\n", 2, error));
+    BOOST_CHECK(!RadixTrie::load("avion x\n", 2, error));
+}
+
+template <typename Costs>
+unsigned weighted_distance(const std::string& a, const std::string& b,
+                           const Costs& costs)
+{
+    WeightedDamerauLevenshtein<Costs> dl;
+    dl.reset(a, 10000, costs);
+    for (auto c : b)
+        dl.feed(c);
+    return dl.dist();
+}
+
+BOOST_AUTO_TEST_CASE(TestWeightedCosts)
+{
+    std::mt19937 rng(42);
+    const char* letters[] = { "a", "b", "c", "\xc3\xa9", "\xc3\xa8" };
+    auto random_word = [&](size_t max_len) {
+        std::string word;
+        for (size_t len = 1 + rng() % max_len; len; len--)
+            word += letters[rng() % 3];
+        return word;
+    };
+    for (int i = 0; i < 300; i++)
+    {
+        std::string a = random_word(10);
+        std::string b = random_word(10);
+        BOOST_CHECK_EQUAL(weighted_distance(a, b, UnitCosts()),
+                          distance_words(a, b));
+    }
+
+    std::string error;
+    auto costs = EditCostTable::load("# French typing\n"
+                                     "transposition 0.5\n"
+                                     "keyboard azerty 0.5  # shifted hand\n"
+                                     "accents 0.1\n"
+                                     "insertion \xc3\xa8 1.5\n", error);
+    BOOST_REQUIRE(costs);
+    BOOST_CHECK_EQUAL(weighted_distance("global", "golbal", *costs), 5u);
+    BOOST_CHECK_EQUAL(weighted_distance("ouiche", "piocje", *costs), 20u);
+    BOOST_CHECK_EQUAL(weighted_distance("\xc3\xa9" "cole", "ecole", *costs),
+                      1u);
+    BOOST_CHECK_EQUAL(weighted_distance("\xc3\xa8", "", *costs), 15u);
+    BOOST_CHECK(!EditCostTable::load("transposition 0.25\n", error));
+    BOOST_CHECK(!EditCostTable::load("keyboard dvorak 1\n", error));
+    BOOST_CHECK(!EditCostTable::load("substitution ab c 1\n", error));
+
+    // Cheap transpositions are found through rows above the distance, and
+    // the characters split between two edges are decoded
+    costs = EditCostTable::load("transposition 0.2\ninsertion 0.7\n"
+                                "deletion c 1.5\nsubstitution a \xc3\xa9 0\n"
+                                "substitution \xc3\xa9 \xc3\xa8 0.3\n",
+                                error);
+    BOOST_REQUIRE(costs);
+    std::map<std::string, unsigned> words;
+    for (int i = 0; i < 2000; i++)
+    {
+        std::string word;
+        for (size_t len = 1 + rng() % 7; len; len--)
+            word += letters[rng() % 5];
+        words[word] = 1 + rng() % 50;
+    }
+    std::string text;
+    for (const auto& w : words)
+        text += w.first + " " + std::to_string(w.second) + "\n";
+    std::string bin = compact(*make_trie(text));
+
+    QueryArena arena;
+    for (int i = 0; i < 30; i++)
+    {
+        std::string q;
+        for (size_t len = 1 + rng() % 7; len; len--)
+            q += letters[rng() % 5];
+        for (unsigned max_cost : { 0u, 2u, 7u, 12u })
+        {
+            std::multimap<unsigned, std::string> expected;
+            for (const auto& w : words)
+            {
+                unsigned d = weighted_distance(q, w.first, *costs);
+                if (d <= max_cost)
+                    expected.emplace(d, w.first);
+            }
+            CompactRadixTrie::weighted_matches(
+                    arena, q, bin.data(), max_cost, *costs,
+                    CompactRadixTrie::no_overlay_t());
+            BOOST_REQUIRE_EQUAL(arena.matches().size(), expected.size());
+            for (const auto& m : arena.matches())
+                BOOST_CHECK_EQUAL(m.distance,
+                                  weighted_distance(q,
+                                                    std::string(arena.word(m)),
+                                                    *costs));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestUtf8Matches)
+{
+    std::mt19937 rng(42);
+    const char* letters[] = { "a", "b", "e", "\xc3\xa9", "\xc3\xa8",
+                              "\xe2\x82\xac", "\xff" };
+    auto random_word = [&](size_t max_len) {
+        std::string word;
+        for (size_t len = 1 + rng() % max_len; len; len--)
+            word += letters[rng() % 7];
+        return word;
+    };
+    std::map<std::string, unsigned> words;
+    for (int i = 0; i < 2000; i++)
+        words[random_word(7)] = 1 + rng() % 50;
+    words[std::string(70, 'a') + "\xc3\xa9"] = 3;
+    std::string text;
+    for (const auto& w : words)
+        text += w.first + " " + std::to_string(w.second) + "\n";
+    std::string bin = compact(*make_trie(text));
+
+    std::vector<std::string> queries;
+    for (int i = 0; i < 30; i++)
+        queries.push_back(random_word(7));
+    queries.push_back(std::string(70, 'a') + "e");
+    QueryArena arena;
+    for (const auto& q : queries)
+        for (unsigned d = 0; d < 3; d++)
+        {
+            std::set<std::string> expected;
+            for (const auto& w : words)
+                if (weighted_distance(q, w.first, UnitCosts()) <= d)
+                    expected.insert(w.first);
+            CompactRadixTrie::utf8_matches(arena, q, bin.data(), d,
+                                           CompactRadixTrie::no_overlay_t());
+            std::set<std::string> found;
+            for (const auto& m : arena.matches())
+            {
+                found.insert(std::string(arena.word(m)));
+                BOOST_CHECK_EQUAL(m.distance,
+                                  weighted_distance(q,
+                                                    std::string(arena.word(m)),
+                                                    UnitCosts()));
+            }
+            BOOST_CHECK(found == expected);
+        }
+
+    auto trie = make_trie("\xc3\xa9" "cole 8\n" "\xc3\xa9" "coles 3\n");
+    bin = compact(*trie);
+    CompactRadixTrie::utf8_matches(arena, "ecole", bin.data(), 1,
+                                   CompactRadixTrie::no_overlay_t());
+    BOOST_CHECK_EQUAL(format_arena(arena), "\xc3\xa9" "cole:8:1 ");
+    CompactRadixTrie::utf8_top_matches(arena, "\xc3\xa8" "coles",
+                                       bin.data(), 1, 2,
+                                       CompactRadixTrie::no_overlay_t());
+    BOOST_CHECK_EQUAL(format_arena(arena), "\xc3\xa9" "coles:3:1 ");
+}